@@ -0,0 +1,80 @@
+/*
+The source file is part of simdmath
+
+Copyright (c) 2015 David Lin <davll.xc@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#ifndef ___SIMD_MATH_EXPF4_H___
+#define ___SIMD_MATH_EXPF4_H___
+
+#include <simdmath.h>
+#include <simdmath/sse/_vec_utils.h>
+#include "floorf4.h"
+
+#define __EXPF_HI    88.3762626647949f
+#define __EXPF_LO   -88.3762626647949f
+#define __EXPF_LOG2E 1.44269504088896341f
+#define __EXPF_C1    0.693359375f
+#define __EXPF_C2   -2.12194440e-4f
+
+#define __EXPF_P0    1.9875691500e-4f
+#define __EXPF_P1    1.3981999507e-3f
+#define __EXPF_P2    8.3334519073e-3f
+#define __EXPF_P3    4.1665795894e-2f
+#define __EXPF_P4    1.6666665459e-1f
+#define __EXPF_P5    5.0000001201e-1f
+
+//
+//     Computes e^x of each of the four slots
+//     by using a polynomial approximation (cephes expf).
+//
+static SIMD_INLINE __m128
+_expf4 (__m128 x)
+{
+  x = _mm_min_ps(x, _mm_set1_ps(__EXPF_HI));
+  x = _mm_max_ps(x, _mm_set1_ps(__EXPF_LO));
+
+  // Range reduction: x = g + n * ln(2)
+  //
+  __m128 n = _floorf4(_maddf4(x, _mm_set1_ps(__EXPF_LOG2E), _mm_set1_ps(0.5f)));
+  x = _nmsubf4(n, _mm_set1_ps(__EXPF_C1), x);
+  x = _nmsubf4(n, _mm_set1_ps(__EXPF_C2), x);
+
+  // e^g = 1 + g + g^2 * P(g)
+  //
+  __m128 x2 = _mm_mul_ps(x, x);
+  __m128 y = _mm_set1_ps(__EXPF_P0);
+  y = _maddf4(y, x, _mm_set1_ps(__EXPF_P1));
+  y = _maddf4(y, x, _mm_set1_ps(__EXPF_P2));
+  y = _maddf4(y, x, _mm_set1_ps(__EXPF_P3));
+  y = _maddf4(y, x, _mm_set1_ps(__EXPF_P4));
+  y = _maddf4(y, x, _mm_set1_ps(__EXPF_P5));
+  y = _maddf4(y, x2, _mm_add_ps(x, _mm_set1_ps(1.0f)));
+
+  // Scale by 2^n
+  //
+  __m128i e = _mm_add_epi32(_mm_cvttps_epi32(n), _mm_set1_epi32(0x7f));
+  __m128 pow2n = _mm_castsi128_ps(_mm_slli_epi32(e, 23));
+
+  return _mm_mul_ps(y, pow2n);
+}
+
+#endif
@@ -28,6 +28,7 @@
 #include "Camera.h"
 #include "morton_code.h"
 #include "VoxelModel.h"
+#include <QFile>
 #include <QList>
 #include <QString>
 #include <vector>
@@ -51,11 +52,151 @@ struct VoxelGraph {
   // z_edges[morton(x,y,z)] => (x, y, z) <--> (x, y, z+1)
 };
 
+//
+// Read-only graph mapped from a binary graph file
+//
+// The foreground bitset and edge arrays are read in place (zero-copy),
+// edges are stored either as float or as double (see float_edges).
+//
+class MappedVoxelGraph {
+public:
+  uint32_t level;
+  uint32_t width;
+  float voxel_size;
+  float voxel_minpos[3];
+  float voxel_maxpos[3];
+  uint64_t length;
+
+  bool float_edges;
+  const uint64_t* foreground_bits;
+  const uchar* edges[3]; // x, y, z
+
+  MappedVoxelGraph();
+  ~MappedVoxelGraph();
+
+  bool map(const QString& path);
+  void unmap();
+
+  inline bool foreground(uint64_t m) const
+  {
+    return (foreground_bits[m >> 6] >> (m & 63)) & 0x1;
+  }
+
+  inline double edge(int axis, uint64_t m) const
+  {
+    if (float_edges)
+      return ((const float*)edges[axis])[m];
+    return ((const double*)edges[axis])[m];
+  }
+
+private:
+  MappedVoxelGraph(const MappedVoxelGraph&) = delete;
+  MappedVoxelGraph& operator=(const MappedVoxelGraph&) = delete;
+
+  QFile m_File;
+  uchar* m_Data;
+};
+
+//
+// Sparse graph made of 8x8x8 bricks
+//
+// A brick holds 512 Morton-contiguous voxels and is allocated only where
+// the visual hull is or where an edge has a non-zero weight. Voxels of
+// missing bricks are background and their edges weigh zero.
+//
+struct SparseVoxelGraph {
+  static const uint32_t BRICK_BITS = 9;
+  static const uint64_t BRICK_VOXELS = 0x1ull << BRICK_BITS;
+
+  struct Brick {
+    uint64_t foreground[BRICK_VOXELS / 64];
+    double edges[3][BRICK_VOXELS]; // x, y, z
+  };
+
+  uint32_t level;
+  uint32_t width;
+  float voxel_size;
+  float voxel_minpos[3];
+  float voxel_maxpos[3];
+
+  // brick_index[m >> BRICK_BITS] => 1 + index into bricks, 0 if missing
+  std::vector<uint32_t> brick_index;
+  // brick code (m >> BRICK_BITS) of every brick in ascending order
+  std::vector<uint64_t> brick_codes;
+  std::vector<Brick> bricks;
+
+  // Allocate zeroed bricks for sorted, unique brick codes
+  // (level must be set beforehand)
+  void allocate(const std::vector<uint64_t>& codes);
+
+  inline const Brick* brick(uint64_t m) const
+  {
+    uint32_t i = brick_index[m >> BRICK_BITS];
+    return (i ? &bricks[i-1] : nullptr);
+  }
+
+  inline Brick* brick(uint64_t m)
+  {
+    uint32_t i = brick_index[m >> BRICK_BITS];
+    return (i ? &bricks[i-1] : nullptr);
+  }
+
+  inline bool foreground(uint64_t m) const
+  {
+    const Brick* b = brick(m);
+    uint64_t k = m & (BRICK_VOXELS-1);
+    return b && ((b->foreground[k >> 6] >> (k & 63)) & 0x1);
+  }
+
+  inline double edge(int axis, uint64_t m) const
+  {
+    const Brick* b = brick(m);
+    return (b ? b->edges[axis][m & (BRICK_VOXELS-1)] : 0.0);
+  }
+};
+
+enum class GraphFormat {
+  Text,        // legacy graph.txt
+  Binary,      // double edges
+  BinaryFloat  // float edges
+};
+
+// num_threads <= 0 uses every hardware thread
 void build_graph(VoxelGraph& graph,
                  const VoxelModel& model,
-                 const QList<Camera>& cameras);
+                 const QList<Camera>& cameras,
+                 int num_threads = 0);
+void build_graph(SparseVoxelGraph& graph,
+                 const VoxelModel& model,
+                 const QList<Camera>& cameras,
+                 int num_threads = 0);
+// Sparse graph with the given foreground voxels instead of the visual hull,
+// e.g. a band around a coarser surface
+void build_graph(SparseVoxelGraph& graph,
+                 const VoxelModel& model,
+                 const QList<Camera>& cameras,
+                 VoxelList foreground,
+                 int num_threads = 0);
+// Same with the visibility maps (PhotoConsistency::needs_visibility) rendered
+// from occluders, e.g. a coarser surface, instead of the surface of the
+// foreground
+void build_graph(SparseVoxelGraph& graph,
+                 const VoxelModel& model,
+                 const QList<Camera>& cameras,
+                 VoxelList foreground,
+                 const VoxelList& occluders,
+                 int num_threads = 0);
 
+// Text, dense and sparse binary files are all accepted
 bool load_graph(VoxelGraph& graph, const QString& path);
-bool save_graph(const VoxelGraph& graph, const QString& path);
+bool load_graph(SparseVoxelGraph& graph, const QString& path);
+// Dense binary files only, mapped without copying
+bool load_graph(MappedVoxelGraph& graph, const QString& path);
+
+// Dense graphs are written densely, sparse graphs brick by brick
+bool save_graph(const VoxelGraph& graph, const QString& path,
+                GraphFormat format = GraphFormat::Binary);
+bool save_graph(const SparseVoxelGraph& graph, const QString& path,
+                GraphFormat format = GraphFormat::Binary);
 
 }
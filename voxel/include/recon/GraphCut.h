@@ -29,6 +29,117 @@
 
 namespace recon {
 
-VoxelList graph_cut(const VoxelGraph& graph, double lambda, double mju);
+// Capacity representation inside the max-flow solver
+enum class CapacityType {
+  Double, // 8 bytes per edge
+  Float,  // 4 bytes per edge
+  Int     // 4 bytes per edge, scaled to 32-bit integers
+};
+
+//
+// Max-flow solver settings
+//
+// num_threads == 1 runs the serial GridGraph_3D_6C, any other value runs
+// the parallel GridGraph_3D_6C_MT (<= 0 uses every hardware thread) on
+// cubic blocks of block_size nodes per side. Both give the same cut.
+//
+struct GraphCutOptions {
+  int num_threads;
+  int block_size;
+  CapacityType capacity;
+
+  GraphCutOptions(int num_threads = 1, int block_size = 32,
+                  CapacityType capacity = CapacityType::Double)
+  : num_threads(num_threads), block_size(block_size), capacity(capacity) {}
+};
+
+// flow (optional) receives the value of the maximum flow
+VoxelList graph_cut(const VoxelGraph& graph, double lambda, double mju,
+                    const GraphCutOptions& options = GraphCutOptions(),
+                    double* flow = nullptr);
+VoxelList graph_cut(const MappedVoxelGraph& graph, double lambda, double mju,
+                    const GraphCutOptions& options = GraphCutOptions(),
+                    double* flow = nullptr);
+VoxelList graph_cut(const SparseVoxelGraph& graph, double lambda, double mju,
+                    const GraphCutOptions& options = GraphCutOptions(),
+                    double* flow = nullptr);
+
+// Estimated peak memory of one graph_cut call in bytes
+uint64_t graph_cut_memory(const VoxelGraph& graph, const GraphCutOptions& options);
+uint64_t graph_cut_memory(const MappedVoxelGraph& graph, const GraphCutOptions& options);
+uint64_t graph_cut_memory(const SparseVoxelGraph& graph, const GraphCutOptions& options);
+
+// Estimated peak memory of a ParametricGraphCut solving num_lambdas lambdas
+uint64_t parametric_cut_memory(const VoxelGraph& graph, const GraphCutOptions& options,
+                               int num_lambdas);
+uint64_t parametric_cut_memory(const MappedVoxelGraph& graph, const GraphCutOptions& options,
+                               int num_lambdas);
+uint64_t parametric_cut_memory(const SparseVoxelGraph& graph, const GraphCutOptions& options,
+                               int num_lambdas);
+
+//
+// Cut of a band graph around a known surface
+//
+// Only the foreground voxels of the graph are solved. Every other voxel is
+// fixed to its bit in inside (bit m & 63 of word m >> 6, set = interior),
+// and its edges to foreground voxels become source or sink edges. The band
+// is solved in tiles of at most tile_size^3 voxels, each one seeing the
+// labels of the tiles before it, so the whole grid never has to fit in the
+// solver. inside receives the labels of the foreground voxels.
+//
+void graph_cut_band(const SparseVoxelGraph& graph, std::vector<uint64_t>& inside,
+                    double lambda, double mju, uint32_t tile_size = 256,
+                    const GraphCutOptions& options = GraphCutOptions());
+
+//
+// Repeated cuts of one graph with a fixed mju and varying lambda
+//
+// Only the source capacities (lambda * h^3) depend on lambda, so the
+// source sets are nested: S(l1) is contained in S(l2) for l1 < l2. The
+// capacities are assembled once, the source set of every solved lambda is
+// kept, and a new lambda is solved only on the voxels between the sets of
+// the closest smaller and larger lambdas; all other voxels are fixed and
+// their edges become terminal edges of the undecided band.
+//
+// With Double capacities the result is the same cut as graph_cut(). Int
+// capacities are rounded once, at the scale graph_cut() uses for
+// max_lambda, so every lambda solves the same rounded problem and the
+// sets stay nested. That scale does not depend on lambda while
+// lambda * h < 29 (h the voxel size), so with max_lambda in that range the
+// cuts equal graph_cut(); source capacities of lambdas above
+// 16 * max(max_lambda, 29 / h) saturate at the infinite capacity. Float
+// capacities are rounded to float after the terminal edges of a band voxel
+// are summed, so a Float cut may differ from graph_cut() within that
+// rounding.
+//
+// The graph must outlive only the constructor.
+//
+class ParametricGraphCut {
+public:
+  ParametricGraphCut(const VoxelGraph& graph, double mju,
+                     const GraphCutOptions& options = GraphCutOptions(),
+                     double max_lambda = 0.0);
+  ParametricGraphCut(const MappedVoxelGraph& graph, double mju,
+                     const GraphCutOptions& options = GraphCutOptions(),
+                     double max_lambda = 0.0);
+  ParametricGraphCut(const SparseVoxelGraph& graph, double mju,
+                     const GraphCutOptions& options = GraphCutOptions(),
+                     double max_lambda = 0.0);
+  ~ParametricGraphCut();
+
+  // flow (optional) receives the value of the minimum cut
+  VoxelList cut(double lambda, double* flow = nullptr);
+
+  // Number of lambdas solved so far
+  int num_solved() const;
+
+  struct State; // capacities and solved source sets, see GraphCut.cpp
+
+private:
+  ParametricGraphCut(const ParametricGraphCut&) = delete;
+  ParametricGraphCut& operator=(const ParametricGraphCut&) = delete;
+
+  State* m_State;
+};
 
 }
@@ -0,0 +1,37 @@
+#pragma once
+
+#include "Camera.h"
+#include "GraphCut.h"
+#include "VoxelModel.h"
+
+namespace recon {
+
+//
+// Coarse-to-fine reconstruction settings
+//
+// The visual hull is cut at level model.level - levels. At every finer
+// level only a band around the previous surface is voted and cut: the
+// voxels where the labels change, dilated by band voxels of the coarser
+// level. The rest keeps the labels of its parent.
+//
+struct PyramidOptions {
+  int levels;      // finer levels after the first cut
+  int band;        // half width of the band in voxels of the coarser level
+  int tile_size;   // largest side of a grid handed to the solver
+                   // (except at the first level, which is cut whole)
+  int num_threads; // voting threads (<= 0 uses every hardware thread)
+  GraphCutOptions cut;
+
+  PyramidOptions(int levels = 2, int band = 2, int tile_size = 256,
+                 int num_threads = 0, const GraphCutOptions& cut = GraphCutOptions())
+  : levels(levels), band(band), tile_size(tile_size)
+  , num_threads(num_threads), cut(cut) {}
+};
+
+// Surface voxels at model.level
+VoxelList reconstruct_pyramid(const VoxelModel& model,
+                              const QList<Camera>& cameras,
+                              double lambda, double mju,
+                              const PyramidOptions& options = PyramidOptions());
+
+}
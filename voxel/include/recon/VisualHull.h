@@ -5,6 +5,13 @@
 
 namespace recon {
 
-VoxelList visual_hull(const VoxelModel& model, const QList<Camera>& cameras);
+// Voxels whose bounding spheres project onto every silhouette, in Morton
+// order (num_threads <= 0 uses every hardware thread). Conservative: a voxel
+// is removed only when it projects entirely outside some silhouette.
+VoxelList visual_hull(const VoxelModel& model, const QList<Camera>& cameras,
+                      int num_threads = 0);
+// Candidates that project onto every silhouette, in their original order
+VoxelList visual_hull(const VoxelModel& model, const QList<Camera>& cameras,
+                      const VoxelList& candidates, int num_threads = 0);
 
 }
@@ -0,0 +1,30 @@
+#include "AllocationCount.h"
+#include <atomic>
+
+namespace recon {
+
+// constant-initialised, so operator new may use it on any thread
+static thread_local uint64_t t_Allocations = 0;
+static std::atomic<bool> g_Counting(false);
+
+void count_allocation()
+{
+  ++t_Allocations;
+}
+
+void enable_allocation_count()
+{
+  g_Counting = true;
+}
+
+bool counting_allocations()
+{
+  return g_Counting;
+}
+
+uint64_t thread_allocations()
+{
+  return t_Allocations;
+}
+
+}
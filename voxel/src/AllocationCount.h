@@ -0,0 +1,20 @@
+#pragma once
+
+#include <stdint.h>
+
+namespace recon {
+
+//
+// Heap allocations of the calling thread
+//
+// The library only reads the counter. A program that wants it replaces
+// the global operator new, calls count_allocation() from it and
+// enable_allocation_count() once at startup (see tools/build-graph.cpp).
+// Otherwise counting_allocations() is false and the counter stays 0.
+//
+void count_allocation();
+void enable_allocation_count();
+bool counting_allocations();
+uint64_t thread_allocations();
+
+}
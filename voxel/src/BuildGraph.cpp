@@ -8,22 +8,336 @@
 #include "VoxelScore1.h"
 //#include "VoxelScore2.h"
 #include "PhotoConsistency.h"
+#include "DepthMap.h"
+#include "ThreadPool.h"
+#include "AllocationCount.h"
 
 #include <QList>
 #include <QImage>
-#include <QTextStream>
-#include <QFile>
 #include <QtDebug>
 #include <algorithm>
+#include <atomic>
+#include <mutex>
 #include <vector>
 #include <float.h>
 #include <math.h>
 
 namespace recon {
 
+// Number of edges voted by one task
+static const uint64_t VOTING_BLOCK_SIZE = 0x1ull << 10;
+
+//
+// Edge key = (morton << 2) | axis
+//   axis 0 => (x, y, z) <--> (x+1, y, z)
+//   axis 1 => (x, y, z) <--> (x, y+1, z)
+//   axis 2 => (x, y, z) <--> (x, y, z+1)
+// where morton is the code of the lower voxel (x, y, z)
+//
+static inline uint64_t edge_key(uint64_t morton, uint32_t axis)
+{
+  return (morton << 2) | axis;
+}
+
+//
+// Enumerate the edges touching at least one voxel of the visual hull,
+// walking the hull voxels and their 6-neighbours only.
+// Keys are returned sorted, hence in Morton order of their lower voxel.
+//
+template<typename IsForeground>
+static std::vector<uint64_t> narrow_band_edges(const VoxelModel& model,
+                                               IsForeground foreground,
+                                               const VoxelList& hull)
+{
+  std::vector<uint64_t> keys;
+  keys.reserve((size_t)hull.size() * 3 + (size_t)hull.size() / 2);
+
+  const uint32_t w = model.width, h = model.height, d = model.depth;
+  for (uint64_t m : hull) {
+    uint32_t p[3];
+    morton_decode(m, p[0], p[1], p[2]);
+    const uint32_t size[3] = { w, h, d };
+
+    for (uint32_t axis = 0; axis < 3; ++axis) {
+      uint32_t q[3] = { p[0], p[1], p[2] };
+      // lower edge is emitted by its upper voxel (this one)
+      if (p[axis] > 0) {
+        q[axis] = p[axis] - 1;
+        keys.push_back(edge_key(morton_encode(q[0], q[1], q[2]), axis));
+      }
+      // upper edge is emitted here only if its upper voxel is not in the hull
+      if (p[axis] + 1 < size[axis]) {
+        q[axis] = p[axis] + 1;
+        if (!foreground(morton_encode(q[0], q[1], q[2])))
+          keys.push_back(edge_key(m, axis));
+      }
+    }
+  }
+
+  std::sort(keys.begin(), keys.end());
+  return keys;
+}
+
+//
+// Voxels of the hull with a 6-neighbour outside of it (or outside the
+// grid), in the order of the hull
+//
+template<typename IsForeground>
+static VoxelList hull_surface(const VoxelModel& model,
+                              IsForeground foreground,
+                              const VoxelList& hull)
+{
+  const uint32_t size[3] = { model.width, model.height, model.depth };
+  VoxelList surface;
+  for (uint64_t m : hull) {
+    uint32_t p[3];
+    morton_decode(m, p[0], p[1], p[2]);
+    bool exposed = false;
+    for (int axis = 0; axis < 3 && !exposed; ++axis) {
+      for (int dir = -1; dir <= 1 && !exposed; dir += 2) {
+        if ((dir < 0 && p[axis] == 0) || (dir > 0 && p[axis] + 1 == size[axis])) {
+          exposed = true;
+          continue;
+        }
+        uint32_t q[3] = { p[0], p[1], p[2] };
+        q[axis] += dir;
+        exposed = !foreground(morton_encode(q[0], q[1], q[2]));
+      }
+    }
+    if (exposed)
+      surface.append(m);
+  }
+  return surface;
+}
+
+//
+// Weights of the edges (sorted keys) from the depth maps of every view
+//
+// Every sample of a map that scores is a point of the surface, splatted
+// onto the nearest face across each axis, the midpoint of an edge. A view
+// adds the best score of its samples on an edge, so the weights are sums
+// over the views like the votes (without the thresholds of combine).
+// Needs the visibility maps of the hull.
+//
+static void fuse_depth_maps(const PhotoConsistency& pc,
+                            const VoxelModel& model,
+                            const std::vector<uint64_t>& edges,
+                            ThreadPool& pool,
+                            std::vector<double>& weights)
+{
+  weights.assign(edges.size(), 0.0);
+  const int num_views = pc.table.size();
+  const int size = (int)model.width;
+  const Point3 center = model.virtual_box.center();
+
+  struct Scratch {
+    DepthMap map;
+    std::vector<std::pair<uint64_t, float> > splats; // edge index, score
+  };
+  std::vector<Scratch> scratch(pool.size());
+  std::mutex mutex;
+  std::atomic<int> done(0);
+  std::atomic<uint64_t> num_samples(0), num_surface(0);
+  pool.run(num_views, [&](uint64_t view, int tid) {
+    DepthMap& map = scratch[tid].map;
+    std::vector<std::pair<uint64_t, float> >& splats = scratch[tid].splats;
+    ClosestCameras ccams(pc.table, pc.images, (int)view, center);
+    {
+      PinnedViews pinned(pc.images);
+      pinned.add((int)view);
+      for (int j = 0; j < ccams.num; ++j)
+        pinned.add(ccams.cam_js[j]);
+      map.sweep(pc.table, pc.images, pc.visibility, ccams, pc.voxel_size);
+    }
+
+    splats.clear();
+    uint64_t count = 0;
+    for (int r = 0; r < map.rows; ++r) {
+      for (int c = 0; c < map.cols; ++c) {
+        const float score = map.score[(size_t)r * map.cols + c];
+        if (!(score > 0.0f))
+          continue;
+        count++;
+        float u[4]; // in voxels
+        ((map.point(c, r) - pc.voxel_minpos) / pc.voxel_size).store(u);
+        if (!(u[0] >= 0.0f && u[1] >= 0.0f && u[2] >= 0.0f &&
+              u[0] < size && u[1] < size && u[2] < size))
+          continue;
+        for (uint32_t axis = 0; axis < 3; ++axis) {
+          // the face between voxels face - 1 and face along axis
+          int face = (int)floorf(u[axis] + 0.5f);
+          if (face < 1 || face >= size)
+            continue;
+          uint32_t q[3] = { (uint32_t)u[0], (uint32_t)u[1], (uint32_t)u[2] };
+          q[axis] = (uint32_t)(face - 1);
+          const uint64_t key = edge_key(morton_encode(q[0], q[1], q[2]), axis);
+          auto it = std::lower_bound(edges.begin(), edges.end(), key);
+          if (it != edges.end() && *it == key)
+            splats.push_back(std::make_pair((uint64_t)(it - edges.begin()), score));
+        }
+      }
+    }
+    num_samples += (uint64_t)map.rows * map.cols;
+    num_surface += count;
+
+    // best score per edge, highest first
+    std::sort(splats.begin(), splats.end(),
+              [](const std::pair<uint64_t, float>& a, const std::pair<uint64_t, float>& b) {
+      return a.first < b.first || (a.first == b.first && a.second > b.second);
+    });
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      for (size_t k = 0; k < splats.size(); ++k) {
+        if (k == 0 || splats[k].first != splats[k - 1].first)
+          weights[splats[k].first] += splats[k].second;
+      }
+    }
+    int n = ++done;
+    if (tid == 0)
+      printf("Depth Maps: %d of %d views\r", n, num_views);
+  });
+  printf("\ndepth maps: %llu of %llu samples on a surface\n",
+         (unsigned long long)num_surface.load(), (unsigned long long)num_samples.load());
+}
+
+//
+// Vote every edge in parallel, with the visibility maps of occluders if
+// PhotoConsistency::UseVisibility, or weight them from depth maps with
+// PhotoConsistency::DepthMapVotes
+// F: void store(uint32_t axis, uint64_t m, double weight)
+//
+template<typename F>
+static void vote_edges(const VoxelModel& model,
+                       const QList<Camera>& cameras,
+                       const std::vector<uint64_t>& edges,
+                       const VoxelList& occluders,
+                       int num_threads,
+                       F store)
+{
+  PhotoConsistency pc(model, cameras, num_threads);
+  if (PhotoConsistency::needs_visibility())
+    pc.render_visibility(model, occluders, num_threads);
+  ThreadPool pool(num_threads);
+  printf("using %d threads\n", pool.size());
+
+  if (PhotoConsistency::DepthMapVotes) {
+    std::vector<double> weights;
+    fuse_depth_maps(pc, model, edges, pool, weights);
+    for (size_t e = 0; e < edges.size(); ++e)
+      store(edges[e] & 0x3, edges[e] >> 2, weights[e]);
+    if (PhotoConsistency::ImageBudget > 0)
+      pc.print_load_times();
+    return;
+  }
+
+  // Every edge is listed once, so the blocks write disjoint elements
+  // and the result does not depend on the schedule
+  const uint64_t n = edges.size();
+  std::atomic<uint64_t> progress(0);
+  // per thread, reused by its blocks so its buffers are not reallocated
+  struct Batch {
+    NeighbourCache cache;
+    std::vector<float> midpoints;
+    std::vector<double> votes;
+    std::vector<int> run_sizes;
+    // votes that did not grow the scratch of the cache and the heap
+    // allocations they made (counting_allocations())
+    uint64_t num_steady;
+    uint64_t num_steady_allocations;
+    Batch() : num_steady(0), num_steady_allocations(0) {}
+  };
+  std::vector<Batch> batches(pool.size());
+  pool.parallel_for(0, n, VOTING_BLOCK_SIZE,
+    [&](uint64_t e0, uint64_t e1, int tid) {
+    Batch& batch = batches[tid];
+    NeighbourCache& cache = batch.cache;
+    std::vector<float>& midpoints = batches[tid].midpoints;
+    std::vector<double>& votes = batches[tid].votes;
+    midpoints.resize(3 * (e1 - e0));
+    votes.resize(e1 - e0);
+    for (uint64_t e = e0; e < e1; ++e) {
+      uint64_t m2 = edges[e] >> 2;
+      uint32_t axis = edges[e] & 0x3;
+
+      // midpoint lies on the min face of the upper voxel
+      uint32_t p[3];
+      morton_decode(m2, p[0], p[1], p[2]);
+      p[axis] += 1;
+      AABox vbox = model.element_box(morton_encode(p[0], p[1], p[2]));
+      Vec3 center = (Vec3)vbox.center();
+      Vec3 minpos = (Vec3)vbox.minpos;
+
+      Vec3 midpoint;
+      switch (axis) {
+      case 0: midpoint = copy_x(center, minpos); break;
+      case 1: midpoint = copy_y(center, minpos); break;
+      default: midpoint = copy_z(center, minpos); break;
+      }
+      float* xyz = &midpoints[3 * (e - e0)];
+      xyz[0] = (float)midpoint.x(), xyz[1] = (float)midpoint.y(), xyz[2] = (float)midpoint.z();
+    }
+    const size_t scratch_bytes = cache.scratch_bytes();
+    const uint64_t allocations = thread_allocations();
+    if (PhotoConsistency::SharedFaceVotes) {
+      // the edges of a lower voxel are consecutive, their midpoints are
+      // the centers of its upper faces
+      std::vector<int>& run_sizes = batches[tid].run_sizes;
+      run_sizes.clear();
+      for (uint64_t e = e0; e < e1; ++e) {
+        if (e > e0 && (edges[e] >> 2) == (edges[e - 1] >> 2))
+          run_sizes.back()++;
+        else
+          run_sizes.push_back(1);
+      }
+      pc.vote_shared(midpoints.data(), run_sizes.data(), (int)run_sizes.size(), cache, votes.data());
+    } else {
+      pc.vote(midpoints.data(), (int)(e1 - e0), cache, votes.data());
+    }
+    if (cache.scratch_bytes() == scratch_bytes) {
+      batch.num_steady++;
+      batch.num_steady_allocations += thread_allocations() - allocations;
+    }
+    for (uint64_t e = e0; e < e1; ++e)
+      store(edges[e] & 0x3, edges[e] >> 2, votes[e - e0]);
+    uint64_t done = (progress += (e1 - e0));
+    if (tid == 0)
+      printf("Building Graph: %.2f %%\r", (float)done/(float)n*100.0f);
+  });
+  printf("\n");
+  {
+    uint64_t num_batches = 0, num_scratch_growths = 0, num_peak_overflows = 0;
+    uint64_t num_view_votes = 0, num_hidden = 0;
+    uint64_t num_steady = 0, num_steady_allocations = 0;
+    for (const Batch& b : batches) {
+      num_steady += b.num_steady;
+      num_steady_allocations += b.num_steady_allocations;
+      num_view_votes += b.cache.num_view_votes;
+      num_hidden += b.cache.num_hidden;
+      num_batches += b.cache.num_batches;
+      num_scratch_growths += b.cache.num_scratch_growths;
+      num_peak_overflows += b.cache.num_peak_overflows;
+    }
+    printf("vote scratch buffers grew in %llu of %llu batches, %llu peak lists overflowed\n",
+           (unsigned long long)num_scratch_growths, (unsigned long long)num_batches,
+           (unsigned long long)num_peak_overflows);
+    if (counting_allocations()) {
+      printf("heap allocations: %llu in %llu batches voted without growing the scratch\n",
+             (unsigned long long)num_steady_allocations, (unsigned long long)num_steady);
+    }
+    if (PhotoConsistency::UseVisibility) {
+      printf("visibility: %llu of %llu view votes skipped (%.1f %%)\n",
+             (unsigned long long)num_hidden, (unsigned long long)num_view_votes,
+             num_view_votes ? 100.0 * num_hidden / num_view_votes : 0.0);
+    }
+  }
+  if (PhotoConsistency::ImageBudget > 0)
+    pc.print_load_times();
+}
+
 void build_graph(VoxelGraph& graph,
                  const VoxelModel& model,
-                 const QList<Camera>& cameras)
+                 const QList<Camera>& cameras,
+                 int num_threads)
 {
   float voxel_h = (float)model.virtual_box.extent().x() / model.width;
 
@@ -35,166 +349,163 @@ void build_graph(VoxelGraph& graph,
 
   // Shape Prior (Visual Hull)
   printf("processing shape prior (visual hull)...\n");
+  VoxelList hull = visual_hull(model, cameras, num_threads);
   {
     std::vector<bool>& foreground = graph.foreground;
     foreground.resize(model.morton_length);
 
-    QList<uint64_t> voxels = visual_hull(model, cameras);
-
     std::fill(foreground.begin(), foreground.end(), false);
-    for (uint64_t m : voxels)
+    for (uint64_t m : hull)
       foreground[m] = true;
   }
 
+  // Narrow Band
+  const std::vector<bool>& foreground = graph.foreground;
+  std::vector<uint64_t> edges = narrow_band_edges(model,
+    [&foreground](uint64_t m) { return (bool)foreground[m]; }, hull);
+  printf("narrow band: %d voxels, %llu edges\n",
+         hull.size(), (unsigned long long)edges.size());
+  VoxelList occluders;
+  if (PhotoConsistency::needs_visibility()) {
+    occluders = hull_surface(model,
+      [&foreground](uint64_t m) { return (bool)foreground[m]; }, hull);
+  }
+  hull = VoxelList();
+
   // Photo-Consistency
   printf("processing surface prior (photo consistency)...\n");
   {
-    std::vector<double>& x_edges = graph.x_edges;
-    std::vector<double>& y_edges = graph.y_edges;
-    std::vector<double>& z_edges = graph.z_edges;
-    x_edges.resize(model.morton_length);
-    y_edges.resize(model.morton_length);
-    z_edges.resize(model.morton_length);
-    std::fill(x_edges.begin(), x_edges.end(), 0.0f);
-    std::fill(y_edges.begin(), y_edges.end(), 0.0f);
-    std::fill(z_edges.begin(), z_edges.end(), 0.0f);
-
-    PhotoConsistency pc(model, cameras);
-    for (uint64_t m = 0, n = model.morton_length; m < n; ++m) {
-      uint32_t x, y, z;
-      morton_decode(m, x, y, z);
-      AABox vbox = model.element_box(m);
-      Vec3 center = (Vec3)vbox.center();
-      Vec3 minpos = (Vec3)vbox.minpos;
-      //printf("current voxel = %d %d %d\n", x, y, z);
-      //if (__builtin_expect(m % (64) == 0, 0))
-      printf("Building Graph: %.2f %%\r", (float)m/(float)n*100.0f);
-
-      if (x > 0) {
-        uint64_t m2 = morton_encode(x-1,y,z);
-        if (graph.foreground[m] || graph.foreground[m2]) {
-          Point3 midpoint = (Point3)copy_x(center, minpos);
-          double v = pc.vote(midpoint);
-          x_edges[m2] = v;
-        }
-      }
-      if (y > 0) {
-        uint64_t m2 = morton_encode(x,y-1,z);
-        if (graph.foreground[m] || graph.foreground[m2]) {
-          Point3 midpoint = (Point3)copy_y(center, minpos);
-          double v = pc.vote(midpoint);
-          y_edges[m2] = v;
-        }
-      }
-      if (z > 0) {
-        uint64_t m2 = morton_encode(x,y,z-1);
-        if (graph.foreground[m] || graph.foreground[m2]) {
-          Point3 midpoint = (Point3)copy_z(center, minpos);
-          double v = pc.vote(midpoint);
-          z_edges[m2] = v;
-        }
-      }
+    std::vector<double>* axis_edges[3] = {
+      &graph.x_edges, &graph.y_edges, &graph.z_edges
+    };
+    for (std::vector<double>* e : axis_edges) {
+      e->resize(model.morton_length);
+      std::fill(e->begin(), e->end(), 0.0);
     }
+
+    vote_edges(model, cameras, edges, occluders, num_threads,
+      [&axis_edges](uint32_t axis, uint64_t m, double w) {
+      (*axis_edges[axis])[m] = w;
+    });
   }
 
   //
   printf("finished building graph\n");
 }
 
-bool load_graph(VoxelGraph& graph, const QString& path)
+// ====================================================================
+
+void SparseVoxelGraph::allocate(const std::vector<uint64_t>& codes)
 {
-  QFile file(path);
-  if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) {
-    qDebug() << "Cannot open graph file!";
-    return false;
-  }
+  uint64_t length = 0x1ull << (3 * level);
+  brick_index.assign(std::max<uint64_t>(1, length >> BRICK_BITS), 0);
+  brick_codes = codes;
+  bricks.assign(codes.size(), Brick());
+  for (size_t i = 0; i < codes.size(); ++i)
+    brick_index[codes[i]] = (uint32_t)(i + 1);
+}
 
-  QTextStream stream(&file);
-
-  stream >> graph.level
-         >> graph.width
-         >> graph.voxel_size
-         >> graph.voxel_minpos[0]
-         >> graph.voxel_minpos[1]
-         >> graph.voxel_minpos[2]
-         >> graph.voxel_maxpos[0]
-         >> graph.voxel_maxpos[1]
-         >> graph.voxel_maxpos[2];
-
-  uint64_t length = graph.width * graph.width * graph.width;
-  graph.foreground.resize(length, false);
-  graph.x_edges.resize(length, 0.0);
-  graph.y_edges.resize(length, 0.0);
-  graph.z_edges.resize(length, 0.0);
-
-  QString xyz, dir;
-  for (uint64_t i = 0; i < length; ++i) {
-    int x, y, z;
-    int flag;
-    stream >> x >> y >> z >> flag;
-    graph.foreground[morton_encode(x, y, z)] = flag;
-  }
+void build_graph(SparseVoxelGraph& graph,
+                 const VoxelModel& model,
+                 const QList<Camera>& cameras,
+                 int num_threads)
+{
+  // Shape Prior (Visual Hull)
+  printf("processing shape prior (visual hull)...\n");
+  build_graph(graph, model, cameras, visual_hull(model, cameras, num_threads), num_threads);
+}
+
+// occluders: nullptr renders the visibility maps from the surface of hull
+static void build_sparse_graph(SparseVoxelGraph& graph,
+                               const VoxelModel& model,
+                               const QList<Camera>& cameras,
+                               VoxelList hull,
+                               const VoxelList* occluders,
+                               int num_threads)
+{
+  typedef SparseVoxelGraph::Brick Brick;
+  const uint32_t bbits = SparseVoxelGraph::BRICK_BITS;
+  const uint64_t bmask = SparseVoxelGraph::BRICK_VOXELS - 1;
+  float voxel_h = (float)model.virtual_box.extent().x() / model.width;
+
+  graph.level = model.level;
+  graph.width = model.width;
+  graph.voxel_size = voxel_h;
+  model.virtual_box.minpos.store(graph.voxel_minpos);
+  model.virtual_box.maxpos.store(graph.voxel_maxpos);
 
-  for (uint64_t i = 0; i < length*3; ++i) {
-    int x, y, z;
-    double w;
-    stream >> x >> y >> z >> w >> dir;
-    if (dir == "+x") {
-      graph.x_edges[morton_encode(x, y, z)] = w;
-    } else if (dir == "+y") {
-      graph.y_edges[morton_encode(x, y, z)] = w;
-    } else if (dir == "+z") {
-      graph.z_edges[morton_encode(x, y, z)] = w;
+  // Bricks of the hull voxels and of their lower neighbours, which own
+  // the edges entering the hull from -x, -y and -z
+  {
+    std::vector<uint64_t> codes;
+    codes.reserve((size_t)hull.size());
+    for (uint64_t m : hull) {
+      uint32_t p[3];
+      morton_decode(m, p[0], p[1], p[2]);
+      codes.push_back(m >> bbits);
+      for (int axis = 0; axis < 3; ++axis) {
+        if (p[axis] == 0)
+          continue;
+        uint32_t q[3] = { p[0], p[1], p[2] };
+        q[axis] -= 1;
+        codes.push_back(morton_encode(q[0], q[1], q[2]) >> bbits);
+      }
     }
+    std::sort(codes.begin(), codes.end());
+    codes.erase(std::unique(codes.begin(), codes.end()), codes.end());
+    graph.allocate(codes);
+  }
+  for (uint64_t m : hull) {
+    uint64_t k = m & bmask;
+    graph.brick(m)->foreground[k >> 6] |= (0x1ull << (k & 63));
   }
+  printf("sparse graph: %llu of %llu bricks\n",
+         (unsigned long long)graph.bricks.size(),
+         (unsigned long long)graph.brick_index.size());
 
-  return true;
+  // Narrow Band
+  const SparseVoxelGraph& sparse = graph;
+  std::vector<uint64_t> edges = narrow_band_edges(model,
+    [&sparse](uint64_t m) { return sparse.foreground(m); }, hull);
+  printf("narrow band: %d voxels, %llu edges\n",
+         hull.size(), (unsigned long long)edges.size());
+  VoxelList surface;
+  if (PhotoConsistency::needs_visibility() && !occluders) {
+    surface = hull_surface(model,
+      [&sparse](uint64_t m) { return sparse.foreground(m); }, hull);
+    occluders = &surface;
+  }
+  hull = VoxelList();
+
+  // Photo-Consistency
+  printf("processing surface prior (photo consistency)...\n");
+  vote_edges(model, cameras, edges, (occluders ? *occluders : surface), num_threads,
+    [&graph,bmask](uint32_t axis, uint64_t m, double w) {
+    Brick* b = graph.brick(m);
+    b->edges[axis][m & bmask] = w;
+  });
+
+  //
+  printf("finished building graph\n");
 }
 
-bool save_graph(const VoxelGraph& graph, const QString& path)
+void build_graph(SparseVoxelGraph& graph,
+                 const VoxelModel& model,
+                 const QList<Camera>& cameras,
+                 VoxelList foreground,
+                 int num_threads)
 {
-  QFile outfile(path);
-  if (!outfile.open(QIODevice::WriteOnly | QIODevice::Text | QIODevice::Truncate)) {
-    qDebug() << "Cannot open output file: " << path;
-    return false;
-  }
-
-  QTextStream stream(&outfile);
-  stream.setRealNumberNotation(QTextStream::ScientificNotation);
-  stream.setRealNumberPrecision(15);
-
-  stream << graph.level << "\n"
-         << graph.width << "\n"
-         << graph.voxel_size << "\n"
-         << graph.voxel_minpos[0] << " "
-         << graph.voxel_minpos[1] << " "
-         << graph.voxel_minpos[2] << "\n"
-         << graph.voxel_maxpos[0] << " "
-         << graph.voxel_maxpos[1] << " "
-         << graph.voxel_maxpos[2] << "\n";
-
-  uint64_t length = graph.width * graph.width * graph.width;
-
-  for (uint64_t m = 0; m < length; ++m) {
-    uint32_t x, y, z;
-    morton_decode(m, x, y, z);
-    stream << x << " " << y << " " << z << " "
-           << graph.foreground[m] << "\n";
-  }
-  for (uint64_t m = 0; m < length; ++m) {
-    uint32_t x, y, z;
-    morton_decode(m, x, y, z);
-    stream << x << " " << y << " " << z << " "
-           << graph.x_edges[m] << " +x\n";
-    stream << x << " " << y << " " << z << " "
-           << graph.y_edges[m] << " +y\n";
-    stream << x << " " << y << " " << z << " "
-           << graph.z_edges[m] << " +z\n";
-  }
+  build_sparse_graph(graph, model, cameras, foreground, nullptr, num_threads);
+}
 
-  stream.flush();
-  outfile.close();
-  return true;
+void build_graph(SparseVoxelGraph& graph,
+                 const VoxelModel& model,
+                 const QList<Camera>& cameras,
+                 VoxelList foreground,
+                 const VoxelList& occluders,
+                 int num_threads)
+{
+  build_sparse_graph(graph, model, cameras, foreground, &occluders, num_threads);
 }
 
 }
@@ -6,38 +6,60 @@
 #include <math.h>
 #include <algorithm>
 #include <QImage>
+#include "ImageStore.h"
 
 namespace recon {
 
 using vectormath::aos::Vec3;
 using vectormath::aos::Vec4;
+using vectormath::aos::Mat3;
 using vectormath::aos::utils::Point3;
 
+static const Mat3 RGB_TO_YUV = Mat3{
+  Vec3{ 0.299f, -0.147f, 0.615f },
+  Vec3{ 0.587f, -0.289f, -0.515f },
+  Vec3{ 0.114f, 0.436f, -0.100f }
+};
+
+static const Vec3 RGB_TO_GRAY = Vec3( 0.299f, 0.587f, 0.114f );
+
+//
+// 11x11 gray window (0.0 - 1.0) around a subpixel position
+//
+// Sampled from a GrayImage, whose padding replaces the clamping of the
+// coordinates, or converted from a color QImage (slow, for tools).
+//
 struct SampleWindow {
   bool valid;
-  Vec3 color[121];
+  float gray[121];
 
   SampleWindow()
   : valid(false)
   {
   }
 
+  SampleWindow(const GrayImage& image, Vec3 xy)
+  : SampleWindow()
+  {
+    set_bilinear(image, xy);
+  }
+
   SampleWindow(const QImage& image, Vec3 xy)
   : SampleWindow()
   {
     set_bilinear(image, xy);
     //set_floor(image, xy);
-
-    // normalize pixel value to 0.0 - 1.0
-    for (int i = 0; i < 121; ++i) {
-      color[i] = color[i] / 255.0f;
-    }
   }
 
-  inline Vec3 operator[](int i) const
+  inline float operator[](int i) const
   {
     Q_ASSERT(i >= 0 && i < 121);
-    return color[i];
+    return gray[i];
+  }
+
+  static inline float to_gray(QRgb c)
+  {
+    return (float)dot(RGB_TO_GRAY, Vec3((float)qRed(c), (float)qGreen(c), (float)qBlue(c))) / 255.0f;
   }
 
   inline void set_floor(const QImage& image, Vec3 xy)
@@ -56,8 +78,7 @@ struct SampleWindow {
         y = (y < 0 ? 0 : y);
         y = (y < height ? y : height-1);
 
-        QRgb c = image.pixel(x, y);
-        color[i*11+j] = Vec3((float)qRed(c), (float)qGreen(c), (float)qBlue(c));
+        gray[i*11+j] = to_gray(image.pixel(x, y));
       }
     }
   }
@@ -69,6 +90,24 @@ struct SampleWindow {
     return (1.0f - fy) * v_0 + fy * v_1;
   }
 
+  inline void set_bilinear(const GrayImage& image, Vec3 xy)
+  {
+    float ix, iy;
+    float fx = modff((float)xy.x(), &ix);
+    float fy = modff((float)xy.y(), &iy);
+
+    int px = (int)ix, py = (int)iy;
+    if (image.valid(px, py)) {
+      for (int i = 0; i < 11; ++i) {
+        const float* r0 = image.row(py - 5 + i) + (px - 5);
+        const float* r1 = image.row(py - 4 + i) + (px - 5);
+        for (int j = 0; j < 11; ++j)
+          gray[i*11+j] = bilinear(fx, fy, r0[j], r0[j+1], r1[j], r1[j+1]);
+      }
+      valid = true;
+    }
+  }
+
   inline void set_bilinear(const QImage& image, Vec3 xy)
   {
     int width = image.width(), height = image.height();
@@ -79,9 +118,7 @@ struct SampleWindow {
 
     int px = (int)ix, py = (int)iy;
     if (px >= 0 && py >= 0 && px < width && py < height) {
-      uint8_t r[12][12];
-      uint8_t g[12][12];
-      uint8_t b[12][12];
+      float g[12][12];
 
       for (int i = 0; i < 12; ++i) {
         for (int j = 0; j < 12; ++j) {
@@ -90,21 +127,13 @@ struct SampleWindow {
           x = (x < width ? x : width-1);
           y = (y < 0 ? 0 : y);
           y = (y < height ? y : height-1);
-          QRgb c = image.pixel(x, y);
-          r[i][j] = qRed(c);
-          g[i][j] = qGreen(c);
-          b[i][j] = qBlue(c);
+          g[i][j] = to_gray(image.pixel(x, y));
         }
       }
 
       for (int i = 0; i < 11; ++i) {
-        for (int j = 0; j < 11; ++j) {
-          int index = i*11+j;
-          float cr = bilinear(fx, fy, r[i][j], r[i][j+1], r[i+1][j], r[i+1][j+1]);
-          float cg = bilinear(fx, fy, g[i][j], g[i][j+1], g[i+1][j], g[i+1][j+1]);
-          float cb = bilinear(fx, fy, b[i][j], b[i][j+1], b[i+1][j], b[i+1][j+1]);
-          color[index] = Vec3(cr, cg, cb);
-        }
+        for (int j = 0; j < 11; ++j)
+          gray[i*11+j] = bilinear(fx, fy, g[i][j], g[i][j+1], g[i+1][j], g[i+1][j+1]);
       }
       valid = true;
     }
@@ -112,14 +141,6 @@ struct SampleWindow {
 
 };
 
-static const Mat3 RGB_TO_YUV = Mat3{
-  Vec3{ 0.299f, -0.147f, 0.615f },
-  Vec3{ 0.587f, -0.289f, -0.515f },
-  Vec3{ 0.114f, 0.436f, -0.100f }
-};
-
-static const Vec3 RGB_TO_GRAY = Vec3( 0.299f, 0.587f, 0.114f );
-
 struct NormalizedCrossCorrelation {
   float value;
 
@@ -130,12 +151,8 @@ struct NormalizedCrossCorrelation {
 
   static float zncc(const SampleWindow& wi, const SampleWindow& wj)
   {
-    // convert RGB to GRAY
-    float yi[121], yj[121];
-    for (int i = 0; i < 121; ++i) {
-      yi[i] = (float)dot(RGB_TO_GRAY, wi[i]);
-      yj[i] = (float)dot(RGB_TO_GRAY, wj[i]);
-    }
+    const float* yi = wi.gray;
+    const float* yj = wj.gray;
 
     // compute mean
     float ai = 0.0f, aj = 0.0f;
@@ -0,0 +1,79 @@
+#include "DepthMap.h"
+#include <algorithm>
+#include <float.h>
+#include <math.h>
+
+namespace recon {
+
+void DepthMap::sweep(const CameraTable& table, const ImageStore& images,
+                     const VisibilityMaps& hull, const ClosestCameras& ccams, float voxel_h)
+{
+  const int view = ccams.cam_i;
+  const int width = images.width(view), height = images.height(view);
+  cols = (width + STRIDE - 1) / STRIDE;
+  rows = (height + STRIDE - 1) / STRIDE;
+  depth.assign((size_t)cols * rows, 0.0f);
+  score.assign((size_t)cols * rows, 0.0f);
+  inverse = vectormath::aos::inverse(table.txfms[view]);
+
+  if (ccams.num < 1)
+    return;
+
+  // transforms of the neighbours and inverse of the view, column major
+  float txfm_js[ClosestCameras::MAX_NUM][16], inv[16];
+  for (int j = 0; j < ccams.num; ++j)
+    ccams.txfm_js[j].store(txfm_js[j]);
+  inverse.store(inv);
+
+  const GrayImage& image_i = images.at(view);
+  for (int r = 0; r < rows; ++r) {
+    for (int c = 0; c < cols; ++c) {
+      const float x = (float)(c * STRIDE), y = (float)(r * STRIDE);
+      const float near = hull.depth(view, x, y);
+      if (near == FLT_MAX)
+        continue; // the ray misses the hull
+      ZnccReference ref(SampleWindow(image_i, Vec3(x, y, 0.0f)));
+      if (!ref.valid)
+        continue;
+
+      // the point at depth d is inv * (x d, y d, 1, d) = a + d b, and its
+      // projection into neighbour j is (p + d q).xy / (p + d q).w
+      float a[4], b[4];
+      for (int k = 0; k < 4; ++k) {
+        a[k] = inv[8 + k];
+        b[k] = x * inv[k] + y * inv[4 + k] + inv[12 + k];
+      }
+      float p[ClosestCameras::MAX_NUM][4], q[ClosestCameras::MAX_NUM][4];
+      for (int j = 0; j < ccams.num; ++j) {
+        const float* m = txfm_js[j];
+        for (int k = 0; k < 4; ++k) {
+          p[j][k] = m[k] * a[0] + m[4 + k] * a[1] + m[8 + k] * a[2] + m[12 + k] * a[3];
+          q[j][k] = m[k] * b[0] + m[4 + k] * b[1] + m[8 + k] * b[2] + m[12 + k] * b[3];
+        }
+      }
+
+      float best_d = 0.0f, best_s = 0.0f;
+      const float d0 = std::max(near - 2.0f * voxel_h, voxel_h);
+      for (int s = 0; s <= 2 + SWEEP_VOXELS; ++s) {
+        const float d = d0 + (float)s * voxel_h;
+        float sum = 0.0f;
+        for (int j = 0; j < ccams.num; ++j) {
+          float w = p[j][3] + d * q[j][3];
+          if (!(w > 0.0f))
+            continue;
+          Vec3 xy_j((p[j][0] + d * q[j][0]) / w, (p[j][1] + d * q[j][1]) / w, 0.0f);
+          float ncc = zncc(ref, SampleWindow(images.at(ccams.cam_js[j]), xy_j));
+          // NOTE: Hard threshold for peaks, as VoxelScore1
+          if (ncc > 0.5f)
+            sum += ncc;
+        }
+        if (sum > best_s)
+          best_d = d, best_s = sum;
+      }
+      depth[(size_t)r * cols + c] = best_d;
+      score[(size_t)r * cols + c] = best_s;
+    }
+  }
+}
+
+}
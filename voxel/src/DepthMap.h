@@ -0,0 +1,46 @@
+#pragma once
+
+#include "VoxelScore1.h"
+#include "VisibilityMap.h"
+#include <vector>
+
+namespace recon {
+
+//
+// Depth of the surface seen by one view, by plane sweep
+//
+// Every STRIDE pixels of the view, its window is correlated (zncc) with
+// the windows of the ClosestCameras neighbours of the view at every depth
+// one voxel apart, from a little before the visual hull (its visibility
+// maps) to SWEEP_VOXELS voxels behind it. The planes are parallel to the
+// image. A depth scores the sum of the ZNCC of the neighbours above 0.5,
+// as the peaks of VoxelScore1, and the best one is kept.
+//
+// The pixels of one ray share their reference window and the projections
+// into the neighbours are linear in depth, so the sweep costs one window
+// sample and one correlation per neighbour and depth.
+//
+struct DepthMap {
+  static const int STRIDE = 2;        // pixels between samples
+  static const int SWEEP_VOXELS = 32; // depths behind the hull
+
+  int cols, rows;
+  std::vector<float> depth; // along the view axis
+  std::vector<float> score; // 0 where no depth scores
+  Mat4 inverse;             // of the transform of the view
+
+  // Map of view ccams.cam_i, which must be pinned in images with its
+  // neighbours ccams.cam_js
+  void sweep(const CameraTable& table, const ImageStore& images,
+             const VisibilityMaps& hull, const ClosestCameras& ccams, float voxel_h);
+
+  // Point of sample (c, r) at its depth
+  inline Point3 point(int c, int r) const
+  {
+    float d = depth[(size_t)r * cols + c];
+    Vec4 p = inverse * Vec4((float)(c * STRIDE) * d, (float)(r * STRIDE) * d, 1.0f, d);
+    return Point3((float)p.x(), (float)p.y(), (float)p.z());
+  }
+};
+
+}
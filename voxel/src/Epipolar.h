@@ -3,7 +3,9 @@
 #include <vectormath.h>
 #include <vectormath/aos/utils/ray3.h>
 #include <QSize>
+#include <xmmintrin.h>
 #include <math.h>
+#include <vector>
 
 namespace recon {
 
@@ -12,6 +14,22 @@ using vectormath::aos::utils::Point3;
 using vectormath::aos::utils::Mat4;
 using vectormath::aos::utils::Ray3;
 
+//
+// Steps of Epipolar::per_pixel<false> as arrays, filled by Epipolar::steps
+//
+// Step k is the point pt0 of the k-th call of the functor, with z = depth.
+// Its pt1 is half a pixel further, the pt0 of step k + 1. The arrays are
+// padded to a multiple of 4 and only grow.
+//
+struct EpipolarSteps {
+  std::vector<float> x, y, depth;
+  int count;
+
+  EpipolarSteps() : count(0) {}
+
+  inline int size() const { return count; }
+};
+
 struct Epipolar {
   int width;
   int height;
@@ -49,6 +67,83 @@ struct Epipolar {
     return copysignf(t, dp);
   }
 
+  //
+  // Segment of depths [-drange, drange] as a line over its dominant axis,
+  // true if along X:
+  //   along X: y = m * x + b, x in [t0, t1]
+  //   along Y: x = m * y + b, y in [t0, t1]
+  //
+  inline bool segment(float drange, float& m, float& b, float& t0, float& t1) const
+  {
+    Vec3 ep0 = lerp2D(-drange), ep1 = lerp2D(drange);
+    float dx = (float)((ep1 - ep0).x());
+    float dy = (float)((ep1 - ep0).y());
+    bool along_x = (fabsf(dx) >= fabsf(dy));
+    if (along_x) {
+      m = (dy / dx);
+      b = (float)ep0.y() - (float)ep0.x() * m;
+      t0 = (float)ep0.x(), t1 = (float)ep1.x();
+    } else {
+      m = (dx / dy);
+      b = (float)ep0.x() - (float)ep0.y() * m;
+      t0 = (float)ep0.y(), t1 = (float)ep1.y();
+    }
+    if (t0 > t1)
+      std::swap(t0, t1);
+    return along_x;
+  }
+
+  //
+  // Steps of per_pixel<false>(f, drange), four at a time with SSE
+  //
+  // The depths are computed as by solve_depth, with the same operations
+  // in the same order.
+  //
+  inline void steps(float drange, EpipolarSteps& out) const
+  {
+    float m, b, t0, t1;
+    bool along_x = segment(drange, m, b, t0, t1);
+    int first = (int)floorf(t0), last = (int)ceilf(t1);
+    out.count = 2 * (last - first + 1);
+    const size_t padded = (size_t)(out.count + 3) & ~(size_t)3;
+    if (out.depth.size() < padded) {
+      out.x.resize(padded);
+      out.y.resize(padded);
+      out.depth.resize(padded);
+    }
+
+    float e[4], d[4];
+    Vec3::proj(ve).store(e);
+    Vec3::proj(vd).store(d);
+    const __m128 ex = _mm_set1_ps(e[0]), ey = _mm_set1_ps(e[1]);
+    const __m128 dx = _mm_set1_ps(d[0]), dy = _mm_set1_ps(d[1]);
+    const __m128 e_w = _mm_set1_ps((float)ve.w()), d_w = _mm_set1_ps((float)vd.w());
+    const __m128 dk = _mm_set1_ps(d_k);
+    const __m128 vm = _mm_set1_ps(m), vb = _mm_set1_ps(b);
+    const __m128 sign = _mm_set1_ps(-0.0f);
+    const __m128 half = _mm_set1_ps(0.5f);
+    const __m128 lane = _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f);
+
+    for (int k = 0; k < out.count; k += 4) {
+      // first + 0.5 k is exact, as x and x + 0.5f in per_pixel
+      __m128 t = _mm_add_ps(_mm_set1_ps((float)first),
+                            _mm_mul_ps(half, _mm_add_ps(_mm_set1_ps((float)k), lane)));
+      __m128 u = _mm_add_ps(_mm_mul_ps(vm, t), vb);
+      __m128 x = (along_x ? t : u), y = (along_x ? u : t);
+
+      // solve_depth
+      __m128 px = _mm_sub_ps(x, ex), py = _mm_sub_ps(y, ey);
+      __m128 len = _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(px, px), _mm_mul_ps(py, py)));
+      __m128 dp = _mm_add_ps(_mm_mul_ps(px, dx), _mm_mul_ps(py, dy));
+      __m128 depth = _mm_div_ps(_mm_mul_ps(e_w, len), _mm_sub_ps(dk, _mm_mul_ps(d_w, len)));
+      depth = _mm_or_ps(_mm_andnot_ps(sign, depth), _mm_and_ps(sign, dp));
+
+      _mm_storeu_ps(&out.x[k], x);
+      _mm_storeu_ps(&out.y[k], y);
+      _mm_storeu_ps(&out.depth[k], depth);
+    }
+  }
+
   //
   // F: void func(Vec3 pt0, Vec3 pt1)
   //    where pt0, pt1 are 2D points with z = depth
@@ -56,13 +151,8 @@ struct Epipolar {
   template<bool GLOBAL = true, typename F>
   void per_pixel(F f, float drange = 1.0f) const
   {
-    // end points
-    Vec3 ep0 = lerp2D(-drange), ep1 = lerp2D(drange);
-    float dx = (float)((ep1 - ep0).x());
-    float dy = (float)((ep1 - ep0).y());
-    if (fabsf(dx) >= fabsf(dy)) { // along X
-      float m = (dy / dx);
-      float b = (float)ep0.y() - (float)ep0.x() * m;
+    float m, b, t0, t1;
+    if (segment(drange, m, b, t0, t1)) { // along X
       auto invoke = [m,b,f,this](float x0, float x1)
       {
         float y0 = m * x0 + b;
@@ -81,11 +171,7 @@ struct Epipolar {
           //invoke(x, x + 1.0f);
         }
       } else {
-        float ex0 = (float)ep0.x();
-        float ex1 = (float)ep1.x();
-        if (ex0 > ex1)
-          std::swap(ex0, ex1);
-        ex0 = floorf(ex0), ex1 = ceilf(ex1);
+        float ex0 = floorf(t0), ex1 = ceilf(t1);
         //printf("ex %f %f\n", ex0, ex1);
         for (int ix = ex0, ix2 = ex1; ix <= ix2; ++ix) {
           float x = ix;
@@ -95,8 +181,6 @@ struct Epipolar {
         }
       }
     } else { // along Y
-      float m = (dx / dy);
-      float b = (float)ep0.x() - (float)ep0.y() * m;
       auto invoke = [m,b,f,this](float y0, float y1)
       {
         float x0 = m * y0 + b;
@@ -115,11 +199,7 @@ struct Epipolar {
           //invoke(y, y + 1.0f);
         }
       } else {
-        float ey0 = (float)ep0.y();
-        float ey1 = (float)ep1.y();
-        if (ey0 > ey1)
-          std::swap(ey0, ey1);
-        ey0 = floorf(ey0), ey1 = ceilf(ey1);
+        float ey0 = floorf(t0), ey1 = ceilf(t1);
         for (int iy = ey0, iy2 = ey1; iy <= iy2; ++iy) {
           float y = iy;
           invoke(y, y+0.5f);
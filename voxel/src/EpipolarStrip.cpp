@@ -0,0 +1,110 @@
+#include "EpipolarStrip.h"
+#include <algorithm>
+#include <math.h>
+
+namespace recon {
+
+// Index clamped to the padded plane, reads the same as clamped to the image
+static inline int clamp_padded(int i, int n)
+{
+  return std::min(std::max(i, -GrayImage::PAD), n - 1 + GrayImage::PAD);
+}
+
+static inline int floor_int(float v)
+{
+  int i = (int)v;
+  return i - (i > v);
+}
+
+// 11 bilinear samples across the line, at (t, u - 5 .. u + 5) along X or at
+// (u - 5 .. u + 5, t) along Y, out[0], out[stride], ...
+static inline void sample_across(const GrayImage& image, bool along_x,
+                                 float t, float u, float* out, int stride)
+{
+  int it = floor_int(t), iu = floor_int(u);
+  float ft = t - it, fu = u - iu;
+  float along[12]; // interpolated along the line first
+  if (along_x) {
+    int x0 = clamp_padded(it, image.width), x1 = clamp_padded(it + 1, image.width);
+    for (int i = 0; i < 12; ++i) {
+      const float* r = image.row(clamp_padded(iu - 5 + i, image.height));
+      along[i] = r[x0] + ft * (r[x1] - r[x0]);
+    }
+  } else {
+    const float* r0 = image.row(clamp_padded(it, image.height));
+    const float* r1 = image.row(clamp_padded(it + 1, image.height));
+    for (int i = 0; i < 12; ++i) {
+      int x = clamp_padded(iu - 5 + i, image.width);
+      along[i] = r0[x] + ft * (r1[x] - r0[x]);
+    }
+  }
+  for (int r = 0; r < 11; ++r)
+    out[r * stride] = along[r] + fu * (along[r + 1] - along[r]);
+}
+
+void EpipolarStrip::correlate(const GrayImage& image, const Epipolar& epipolar,
+                              const ZnccReference& ref, float drange)
+{
+  float m, b, t0, t1;
+  bool along_x = epipolar.segment(drange, m, b, t0, t1);
+
+  // steps as in per_pixel<false>: s at first + s / 2
+  float first = floorf(t0);
+  epipolar.steps(drange, steps);
+  const int num_steps = steps.size();
+  ncc.assign(num_steps, -1.0f);
+  if (!ref.valid)
+    return;
+
+  // column c lies at first - 5 + c / 2, the window of step s is made of
+  // the columns s, s + 2, ..., s + 20
+  m_Columns = num_steps + 20;
+  m_Strip.resize(11 * m_Columns);
+  m_Sum.resize(m_Columns);
+  m_SumSq.resize(m_Columns);
+  for (int c = 0; c < m_Columns; ++c) {
+    float t = first - 5.0f + 0.5f * c;
+    sample_across(image, along_x, t, m * t + b, m_Strip.data() + c, m_Columns);
+    double sum = 0.0, sumsq = 0.0;
+    for (int r = 0; r < 11; ++r) {
+      float v = m_Strip[r * m_Columns + c];
+      sum += v, sumsq += (double)v * v;
+    }
+    m_Sum[c] = sum + (c >= 2 ? m_Sum[c - 2] : 0.0);
+    m_SumSq[c] = sumsq + (c >= 2 ? m_SumSq[c - 2] : 0.0);
+  }
+
+  // reference sample (row across, column along) of the strip layout
+  float vs[121];
+  double vsum = 0.0;
+  for (int r = 0; r < 11; ++r) {
+    for (int k = 0; k < 11; ++k) {
+      vs[r * 11 + k] = (along_x ? ref.v[r * 11 + k] : ref.v[k * 11 + r]);
+      vsum += vs[r * 11 + k];
+    }
+  }
+
+  m_Dot.assign(num_steps, 0.0f);
+  float* dot = m_Dot.data();
+  for (int r = 0; r < 11; ++r) {
+    for (int k = 0; k < 11; ++k) {
+      const float v = vs[r * 11 + k];
+      const float* strip = m_Strip.data() + r * m_Columns + 2 * k;
+      for (int s = 0; s < num_steps; ++s)
+        dot[s] += v * strip[s];
+    }
+  }
+
+  for (int s = 0; s < num_steps; ++s) {
+    // SampleWindow is valid if its truncated center is in the image
+    if (!image.valid((int)steps.x[s], (int)steps.y[s]))
+      continue;
+    double sum = m_Sum[s + 20] - (s >= 2 ? m_Sum[s - 2] : 0.0);
+    double sumsq = m_SumSq[s + 20] - (s >= 2 ? m_SumSq[s - 2] : 0.0);
+    double mean = sum / 121.0;
+    double ss = sumsq - sum * mean;
+    ncc[s] = (ss > 0.0 ? (float)((dot[s] - mean * vsum) / sqrt(ss)) : NAN);
+  }
+}
+
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include "Camera.h"
+#include "Epipolar.h"
+#include "ImageStore.h"
+#include "Zncc.h"
+#include <vector>
+
+namespace recon {
+
+//
+// ZNCC of a reference window along an epipolar segment, rectified
+//
+// The image is resampled once into a strip that follows the line: 11 rows
+// across it, one column per half pixel along its dominant axis. The window
+// of every step of Epipolar::per_pixel<false> is made of every other column
+// of the strip, so it follows the line too (sheared by the slope instead of
+// axis aligned), and stepping by half a pixel shifts it by one column.
+//
+// The means and norms of all windows come from sliding sums of the columns,
+// constant work per step. The dot product with the reference is one pass of
+// 121 multiply-adds per step over contiguous strip rows, without sampling
+// a window per step.
+//
+class EpipolarStrip {
+public:
+  // Steps of per_pixel<false> (Epipolar::steps)
+  EpipolarSteps steps;
+  // ZNCC per step, -1 where the step is outside the image or the reference
+  // is invalid, NaN for a flat window
+  std::vector<float> ncc;
+
+  void correlate(const GrayImage& image, const Epipolar& epipolar,
+                 const ZnccReference& ref, float drange);
+
+private:
+  std::vector<float> m_Strip;  // 11 rows of m_Columns
+  std::vector<double> m_Sum;   // per column parity: prefix sums of columns
+  std::vector<double> m_SumSq;
+  std::vector<float> m_Dot;
+  int m_Columns;
+};
+
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include "BuildGraph.h"
+#include <vector>
+
+namespace recon {
+
+//
+// Uniform access to dense, mapped and sparse graphs
+//
+// is_foreground(graph, m)
+// edge_weight(graph, axis, m)  where axis 0, 1, 2 => +x, +y, +z
+//
+
+inline bool is_foreground(const VoxelGraph& g, uint64_t m)
+{
+  return g.foreground[m];
+}
+
+inline double edge_weight(const VoxelGraph& g, int axis, uint64_t m)
+{
+  switch (axis) {
+  case 0: return g.x_edges[m];
+  case 1: return g.y_edges[m];
+  default: return g.z_edges[m];
+  }
+}
+
+inline bool is_foreground(const MappedVoxelGraph& g, uint64_t m)
+{
+  return g.foreground(m);
+}
+
+inline double edge_weight(const MappedVoxelGraph& g, int axis, uint64_t m)
+{
+  return g.edge(axis, m);
+}
+
+inline bool is_foreground(const SparseVoxelGraph& g, uint64_t m)
+{
+  return g.foreground(m);
+}
+
+inline double edge_weight(const SparseVoxelGraph& g, int axis, uint64_t m)
+{
+  return g.edge(axis, m);
+}
+
+//
+// Voxel bitsets: bit (m & 63) of word (m >> 6) belongs to voxel m
+//
+
+inline bool test_bit(const std::vector<uint64_t>& bits, uint64_t m)
+{
+  return (bits[m >> 6] >> (m & 63)) & 0x1;
+}
+
+inline void assign_bit(std::vector<uint64_t>& bits, uint64_t m, bool value)
+{
+  if (value)
+    bits[m >> 6] |= (0x1ull << (m & 63));
+  else
+    bits[m >> 6] &= ~(0x1ull << (m & 63));
+}
+
+}
@@ -1,8 +1,17 @@
 #include "morton_code.h"
 #include "GraphCut.h"
+#include "GraphAccess.h"
+#include "ThreadPool.h"
+#include <simdmath.h>
 #include <GridCut/GridGraph_3D_6C.h>
+#include <GridCut/GridGraph_3D_6C_MT.h>
+#include <QElapsedTimer>
 #include <QList>
 #include <algorithm>
+#include <atomic>
+#include <iterator>
+#include <limits>
+#include <map>
 #include <vector>
 #include <float.h>
 #include <math.h>
@@ -17,81 +26,964 @@ using vectormath::aos::Vec3;
 using vectormath::aos::Vec4;
 using vectormath::aos::utils::Point3;
 
-VoxelList graph_cut(const VoxelGraph& vgraph, double lambda, double mju)
+//
+// Sub-grid handed to the solver
+//
+// Voxels outside the region must be background: they are tied to the sink
+// with infinite capacity, so the edges leading to them become sink edges of
+// the boundary nodes and the cut is the same as on the whole grid.
+//
+struct CutRegion {
+  uint32_t x0, y0, z0;
+  uint32_t w, h, d;
+};
+
+//
+// Conversion of capacities to the solver's representation
+//
+// Integer capacities are scaled so the largest finite capacity of a node
+// stays far below the value used as infinity.
+//
+template<typename T>
+struct CapType {
+  static T infinity() { return std::numeric_limits<T>::infinity(); }
+  static T convert(double cap, double) { return (T)cap; }
+};
+
+template<>
+struct CapType<int32_t> {
+  static int32_t infinity() { return 0x1 << 30; }
+  static int32_t convert(double cap, double scale)
+  {
+    return (int32_t)std::min(llround(cap * scale), (long long)infinity());
+  }
+};
+
+//
+// Capacities of the region in GridCut's x-fastest layout (i = x + w*y + w*h*z)
+//
+// Neighbour capacities are symmetric, so only the +x, +y and +z arrays are
+// stored. Each one is preceded by one row, slice or element of zeros so the
+// -x, -y and -z arrays are the same buffers read at an offset:
+//   lee[i] = gee[i-1], ele[i] = ege[i-w], eel[i] = eeg[i-w*h]
+// The zeros on the upper faces then also give zero capacities on the lower
+// faces.
+//
+template<typename TCap, typename NCap>
+struct CutCaps {
+  uint64_t dy, dz;
+  double scale; // solver capacity = scale * capacity
+  std::vector<TCap> source;
+  std::vector<TCap> sink;
+  std::vector<NCap> xcap, ycap, zcap;
+
+  CutCaps(const CutRegion& region, double scale)
+  : dy(region.w)
+  , dz((uint64_t)region.w * region.h)
+  , scale(scale)
+  {
+    uint64_t n = dz * region.d;
+    source.assign(n, 0);
+    sink.assign(n, 0);
+    xcap.assign(n + 1, 0);
+    ycap.assign(n + dy, 0);
+    zcap.assign(n + dz, 0);
+  }
+
+  NCap* gee() { return xcap.data() + 1; }
+  NCap* ege() { return ycap.data() + dy; }
+  NCap* eeg() { return zcap.data() + dz; }
+
+  // Hand every capacity to the solver at once and free the arrays
+  template<typename GridGraph>
+  void upload(GridGraph& graph)
+  {
+    graph.set_caps(source.data(), sink.data(),
+                   xcap.data(), gee(),
+                   ycap.data(), ege(),
+                   zcap.data(), eeg());
+    source = sink = std::vector<TCap>();
+    xcap = ycap = zcap = std::vector<NCap>();
+  }
+};
+
+// Scaled integer capacities of a node stay below this (infinity is 2^30)
+static const double INT_CAPACITY_RANGE = (double)(0x1 << 26);
+
+static const uint32_t CUT_BRICK_BITS = 9;
+static const uint32_t CUT_BRICK_WIDTH = 8;
+static const uint32_t CUT_BRICK_VOXELS = 0x1u << CUT_BRICK_BITS;
+
+//
+// Precision of the neighbour weights wn * exp(-mju * e)
+//
+// The double solver keeps the scalar double exp, so its cut is a true
+// double-precision reference; float and integer capacities are computed
+// in single precision, four at a time with expf4.
+//
+template<typename NCap>
+struct NeighbourWeight {
+  typedef float type;
+};
+
+template<>
+struct NeighbourWeight<double> {
+  typedef double type;
+};
+
+// exp(-mju * e) in the precision of e
+static inline double neighbour_exp(float e, double mju) { return expf(-(float)mju * e); }
+static inline double neighbour_exp(double e, double mju) { return exp(-mju * e); }
+
+// caps[k] = wn * exp(-mju * edges[k])
+static void exp_caps(double* caps, const double* edges, uint32_t n, double mju, double wn)
 {
-  // Allocate Graph
-  using GridGraph = GridGraph_3D_6C<double, double, double>;
-  GridGraph graph(vgraph.width, vgraph.width, vgraph.width);
+  for (uint32_t k = 0; k < n; ++k)
+    caps[k] = wn * exp(-mju * edges[k]);
+}
 
-  const uint64_t length = vgraph.width * vgraph.width * vgraph.width;
+// caps[k] = wn * exp(-mju * edges[k]), four at a time
+static void exp_caps(float* caps, const float* edges, uint32_t n, float mju, float wn)
+{
+  const __m128 vmju = _mm_set1_ps(-mju), vwn = _mm_set1_ps(wn);
+  uint32_t k = 0;
+  for (; k + 4 <= n; k += 4) {
+    __m128 e = _mm_loadu_ps(edges + k);
+    _mm_storeu_ps(caps + k, _mm_mul_ps(vwn, expf4(_mm_mul_ps(vmju, e))));
+  }
+  for (; k < n; ++k)
+    caps[k] = wn * expf(-mju * edges[k]);
+}
+
+//
+// Convert a Morton-ordered graph into CutCaps
+//
+// The region is walked in 8x8x8 bricks of 512 Morton-contiguous voxels
+// (origin of the region must be a multiple of 8). A brick is read
+// sequentially, its exp weights are computed in one batch (of precision W)
+// and then written into 64 rows of 8 nodes of the x-fastest arrays. Bricks
+// write disjoint nodes, so they are converted in parallel.
+//
+template<typename TCap, typename NCap, typename Graph,
+         typename W = typename NeighbourWeight<NCap>::type>
+static void assemble_caps(CutCaps<TCap, NCap>& caps, const Graph& vgraph, const CutRegion& region,
+                          double lambda, double mju, int num_threads)
+{
+  const uint32_t width = vgraph.width;
   const double voxel_h = vgraph.voxel_size;
   const double wb = lambda * voxel_h * voxel_h * voxel_h;
   const double wn = 4.0 / 3.0 * M_PI * voxel_h * voxel_h;
+  const uint32_t size[3] = { region.w, region.h, region.d };
+  const uint32_t origin[3] = { region.x0, region.y0, region.z0 };
 
-  // Setup Terminal Edges
-  for (uint64_t m = 0; m < length; ++m) {
+  // Local coordinates of the voxels of a brick
+  uint8_t local[CUT_BRICK_VOXELS][3];
+  for (uint32_t k = 0; k < CUT_BRICK_VOXELS; ++k) {
     uint32_t x, y, z;
-    morton_decode(m, x, y, z);
-    int node = graph.node_id(x, y, z);
+    morton_decode(k, x, y, z);
+    local[k][0] = x, local[k][1] = y, local[k][2] = z;
+  }
+
+  uint32_t nb[3];
+  for (int axis = 0; axis < 3; ++axis)
+    nb[axis] = (size[axis] + CUT_BRICK_WIDTH - 1) / CUT_BRICK_WIDTH;
+  const uint64_t num_bricks = (uint64_t)nb[0] * nb[1] * nb[2];
+
+  NCap* ncaps[3] = { caps.gee(), caps.ege(), caps.eeg() };
+  const TCap source_cap = CapType<TCap>::convert(wb, caps.scale);
+
+  ThreadPool pool(num_threads);
+  pool.parallel_for(0, num_bricks, 1, [&](uint64_t b0, uint64_t b1, int) {
+    W edges[3][CUT_BRICK_VOXELS];
+    W ncap[3][CUT_BRICK_VOXELS];
+
+    for (uint64_t b = b0; b < b1; ++b) {
+      // brick origin, x fastest like the output arrays
+      const uint32_t bp[3] = {
+        (uint32_t)(b % nb[0]) * CUT_BRICK_WIDTH,
+        (uint32_t)(b / nb[0] % nb[1]) * CUT_BRICK_WIDTH,
+        (uint32_t)(b / nb[0] / nb[1]) * CUT_BRICK_WIDTH
+      };
+      const uint64_t m0 = morton_encode(origin[0] + bp[0], origin[1] + bp[1], origin[2] + bp[2]);
+      const bool whole = (bp[0] + CUT_BRICK_WIDTH <= size[0] &&
+                          bp[1] + CUT_BRICK_WIDTH <= size[1] &&
+                          bp[2] + CUT_BRICK_WIDTH <= size[2]);
+
+      // Read the brick
+      for (uint32_t k = 0; k < CUT_BRICK_VOXELS; ++k) {
+        bool inside = whole || (bp[0] + local[k][0] < size[0] &&
+                                bp[1] + local[k][1] < size[1] &&
+                                bp[2] + local[k][2] < size[2]);
+        for (int axis = 0; axis < 3; ++axis)
+          edges[axis][k] = (inside ? (W)edge_weight(vgraph, axis, m0 + k) : (W)0);
+      }
+      for (int axis = 0; axis < 3; ++axis)
+        exp_caps(ncap[axis], edges[axis], CUT_BRICK_VOXELS, (W)mju, (W)wn);
 
-    if (vgraph.foreground[m]) {
-      graph.set_terminal_cap(node, wb, 0.0);
-    } else {
-      graph.set_terminal_cap(node, 0.0, INFINITY);
+      // Scatter it
+      for (uint32_t k = 0; k < CUT_BRICK_VOXELS; ++k) {
+        uint32_t q[3], p[3];
+        for (int axis = 0; axis < 3; ++axis) {
+          q[axis] = bp[axis] + local[k][axis];
+          p[axis] = origin[axis] + q[axis];
+        }
+        if (!whole && (q[0] >= size[0] || q[1] >= size[1] || q[2] >= size[2]))
+          continue;
+
+        const uint64_t i = q[0] + caps.dy * q[1] + caps.dz * q[2];
+        double sink = INFINITY;
+        if (is_foreground(vgraph, m0 + k)) {
+          caps.source[i] = source_cap;
+          sink = 0.0;
+        }
+
+        for (int axis = 0; axis < 3; ++axis) {
+          if (q[axis] + 1 < size[axis]) {
+            ncaps[axis][i] = CapType<NCap>::convert(ncap[axis][k], caps.scale);
+          } else if (p[axis] + 1 < width) {
+            // upper neighbour lies outside the region
+            sink += ncap[axis][k];
+          }
+          if (q[axis] == 0 && p[axis] > 0) {
+            // lower neighbour lies outside the region
+            uint32_t r[3] = { p[0], p[1], p[2] };
+            r[axis] -= 1;
+            W e = (W)edge_weight(vgraph, axis, morton_encode(r[0], r[1], r[2]));
+            sink += wn * neighbour_exp(e, mju);
+          }
+        }
+        caps.sink[i] = (isinf(sink) ? CapType<TCap>::infinity()
+                                    : CapType<TCap>::convert(sink, caps.scale));
+      }
+    }
+  });
+}
+
+// Surface voxels of the source segment
+// (neighbours outside the region are background)
+static VoxelList export_surface(const std::vector<bool>& source, const CutRegion& region)
+{
+  QList<uint64_t> result;
+  const int w = region.w, h = region.h, d = region.d;
+  const uint64_t dy = w, dz = (uint64_t)w * h;
+  for (int x = 0; x < w; ++x) {
+    for (int y = 0; y < h; ++y) {
+      for (int z = 0; z < d; ++z) {
+        const uint64_t i = x + dy * y + dz * z;
+        if (!source[i])
+          continue;
+
+        bool surface =
+          (x == 0 || !source[i - 1]) || (x == w-1 || !source[i + 1]) ||
+          (y == 0 || !source[i - dy]) || (y == h-1 || !source[i + dy]) ||
+          (z == 0 || !source[i - dz]) || (z == d-1 || !source[i + dz]);
+
+        if (surface)
+          result.append(morton_encode(region.x0 + x, region.y0 + y, region.z0 + z));
+      }
     }
   }
 
-  // Setup Neighbour Edges
-  for (uint64_t m = 0; m < length; ++m) {
+  return result;
+}
+
+//
+// Maximum flow of assembled capacities on a w x h x d grid
+//
+// source[i] receives the segment of every node (true = source side).
+// Returns the flow in the solver's units (divide by caps.scale).
+//
+template<typename TCap, typename NCap, typename Flow>
+static double maxflow(CutCaps<TCap, NCap>& caps, int w, int h, int d,
+                      const GraphCutOptions& options, std::vector<bool>& source)
+{
+  QElapsedTimer timer;
+  timer.start();
+
+  source.assign((uint64_t)w * h * d, false);
+  double total;
+  if (options.num_threads == 1) {
+    GridGraph_3D_6C<TCap, TCap, Flow> graph(w, h, d);
+    caps.upload(graph);
+    graph.compute_maxflow();
+    printf("max-flow: %.3f s\n", timer.elapsed() / 1000.0);
+    total = (double)graph.get_flow();
+    uint64_t i = 0;
+    for (int z = 0; z < d; ++z)
+      for (int y = 0; y < h; ++y)
+        for (int x = 0; x < w; ++x, ++i)
+          source[i] = (graph.get_segment(graph.node_id(x, y, z)) == 0);
+  } else {
+    int num_threads = (options.num_threads > 0 ? options.num_threads
+                                               : ThreadPool::default_size());
+    printf("parallel max-flow: %d threads, block size %d\n",
+           num_threads, options.block_size);
+    GridGraph_3D_6C_MT<TCap, TCap, Flow> graph(w, h, d, num_threads, options.block_size);
+    caps.upload(graph);
+    graph.compute_maxflow();
+    printf("max-flow: %.3f s\n", timer.elapsed() / 1000.0);
+    total = (double)graph.get_flow();
+    uint64_t i = 0;
+    for (int z = 0; z < d; ++z)
+      for (int y = 0; y < h; ++y)
+        for (int x = 0; x < w; ++x, ++i)
+          source[i] = (graph.get_segment(graph.node_id(x, y, z)) == 0);
+  }
+  return total;
+}
+
+//
+// Solve with GridCut capacities of type TCap (terminal and neighbour edges
+// inside the solver), assembled from neighbour capacities of type NCap
+//
+template<typename TCap, typename NCap, typename Flow, typename Graph>
+static VoxelList solve(const Graph& vgraph, const CutRegion& region,
+                       double lambda, double mju,
+                       const GraphCutOptions& options, double scale,
+                       double* flow)
+{
+  QElapsedTimer timer;
+  timer.start();
+
+  // Assemble Graph
+  CutCaps<TCap, NCap> caps(region, scale);
+  assemble_caps(caps, vgraph, region, lambda, mju, options.num_threads);
+  printf("graph assembly: %.3f s\n", timer.restart() / 1000.0);
+
+  // Maximum Flow
+  std::vector<bool> source;
+  double total = maxflow<TCap, NCap, Flow>(caps, region.w, region.h, region.d, options, source);
+
+  total /= scale;
+  printf("flow = %lf\n", total);
+  if (flow)
+    *flow = total;
+  return export_surface(source, region);
+}
+
+// Scale of integer capacities: largest finite capacity of a node => INT_CAPACITY_RANGE
+static double int_capacity_scale(double voxel_h, double lambda)
+{
+  const double wb = lambda * voxel_h * voxel_h * voxel_h;
+  const double wn = 4.0 / 3.0 * M_PI * voxel_h * voxel_h;
+  return INT_CAPACITY_RANGE / std::max(wb, 7.0 * wn);
+}
+
+template<typename Graph>
+static VoxelList graph_cut_impl(const Graph& vgraph, const CutRegion& region,
+                                double lambda, double mju,
+                                const GraphCutOptions& options, double* flow)
+{
+  switch (options.capacity) {
+  case CapacityType::Float:
+    return solve<float, float, double>(vgraph, region, lambda, mju, options, 1.0, flow);
+  case CapacityType::Int:
+    return solve<int32_t, int32_t, int64_t>(vgraph, region, lambda, mju, options,
+                                            int_capacity_scale(vgraph.voxel_size, lambda), flow);
+  default:
+    return solve<double, double, double>(vgraph, region, lambda, mju, options, 1.0, flow);
+  }
+}
+
+// Dense graphs are solved on the whole grid
+template<typename Graph>
+static CutRegion cut_region(const Graph& vgraph)
+{
+  return CutRegion{ 0, 0, 0, vgraph.width, vgraph.width, vgraph.width };
+}
+
+// Sparse graphs are solved on the bounding box of the allocated bricks
+static CutRegion cut_region(const SparseVoxelGraph& graph)
+{
+  if (graph.bricks.empty())
+    return CutRegion{ 0, 0, 0, 0, 0, 0 };
+
+  const uint32_t bw = std::min<uint32_t>(8, graph.width);
+  uint32_t lo[3] = { graph.width, graph.width, graph.width };
+  uint32_t hi[3] = { 0, 0, 0 };
+  for (uint64_t code : graph.brick_codes) {
+    uint32_t p[3];
+    morton_decode(code << SparseVoxelGraph::BRICK_BITS, p[0], p[1], p[2]);
+    for (int i = 0; i < 3; ++i) {
+      lo[i] = std::min(lo[i], p[i]);
+      hi[i] = std::max(hi[i], p[i] + bw);
+    }
+  }
+  return CutRegion{ lo[0], lo[1], lo[2], hi[0]-lo[0], hi[1]-lo[1], hi[2]-lo[2] };
+}
+
+template<typename Graph>
+static VoxelList graph_cut_region(const Graph& vgraph, double lambda, double mju,
+                                  const GraphCutOptions& options, double* flow)
+{
+  CutRegion region = cut_region(vgraph);
+  if (region.w == 0) {
+    if (flow)
+      *flow = 0.0;
+    return VoxelList();
+  }
+  if (region.w != vgraph.width || region.h != vgraph.width || region.d != vgraph.width) {
+    printf("cut region: %u x %u x %u at (%u, %u, %u)\n",
+           region.w, region.h, region.d, region.x0, region.y0, region.z0);
+  }
+  return graph_cut_impl(vgraph, region, lambda, mju, options, flow);
+}
+
+//
+// Peak memory of graph_cut_impl: the solver's arrays (on a grid padded to
+// a multiple of 4) plus the assembled capacities, which coexist while they
+// are uploaded
+//
+template<typename Graph>
+static uint64_t graph_cut_memory_impl(const Graph& vgraph, const GraphCutOptions& options)
+{
+  CutRegion region = cut_region(vgraph);
+  uint64_t n = (uint64_t)region.w * region.h * region.d;
+  uint64_t padded = (uint64_t)((region.w + 5) & ~3) * ((region.h + 5) & ~3) * ((region.d + 5) & ~3);
+  if (n == 0)
+    return 0;
+
+  // solver capacity, assembled neighbour capacity
+  uint64_t cap = 8, ncap = 8;
+  if (options.capacity != CapacityType::Double)
+    cap = ncap = 4;
+
+  // labels, parents, distances, time stamps, queues: about 32 bytes
+  return padded * (32 + 7 * cap) + n * (2 * cap + 3 * ncap);
+}
+
+//
+// Peak memory of a parametric cut: the kept capacities at lambda = 1
+// (double source, sink and neighbours), a source set per lambda plus the
+// two of the band being solved, and the solver of one band (at most the
+// whole region)
+//
+template<typename Graph>
+static uint64_t parametric_cut_memory_impl(const Graph& vgraph, const GraphCutOptions& options,
+                                           int num_lambdas)
+{
+  CutRegion region = cut_region(vgraph);
+  uint64_t n = (uint64_t)region.w * region.h * region.d;
+  return n * 5 * sizeof(double) + (uint64_t)(num_lambdas + 2) * ((n + 7) / 8) +
+         graph_cut_memory_impl(vgraph, options);
+}
+
+VoxelList graph_cut(const VoxelGraph& graph, double lambda, double mju,
+                    const GraphCutOptions& options, double* flow)
+{
+  return graph_cut_region(graph, lambda, mju, options, flow);
+}
+
+VoxelList graph_cut(const MappedVoxelGraph& graph, double lambda, double mju,
+                    const GraphCutOptions& options, double* flow)
+{
+  return graph_cut_region(graph, lambda, mju, options, flow);
+}
+
+VoxelList graph_cut(const SparseVoxelGraph& graph, double lambda, double mju,
+                    const GraphCutOptions& options, double* flow)
+{
+  return graph_cut_region(graph, lambda, mju, options, flow);
+}
+
+uint64_t graph_cut_memory(const VoxelGraph& graph, const GraphCutOptions& options)
+{
+  return graph_cut_memory_impl(graph, options);
+}
+
+uint64_t graph_cut_memory(const MappedVoxelGraph& graph, const GraphCutOptions& options)
+{
+  return graph_cut_memory_impl(graph, options);
+}
+
+uint64_t graph_cut_memory(const SparseVoxelGraph& graph, const GraphCutOptions& options)
+{
+  return graph_cut_memory_impl(graph, options);
+}
+
+uint64_t parametric_cut_memory(const VoxelGraph& graph, const GraphCutOptions& options,
+                               int num_lambdas)
+{
+  return parametric_cut_memory_impl(graph, options, num_lambdas);
+}
+
+uint64_t parametric_cut_memory(const MappedVoxelGraph& graph, const GraphCutOptions& options,
+                               int num_lambdas)
+{
+  return parametric_cut_memory_impl(graph, options, num_lambdas);
+}
+
+uint64_t parametric_cut_memory(const SparseVoxelGraph& graph, const GraphCutOptions& options,
+                               int num_lambdas)
+{
+  return parametric_cut_memory_impl(graph, options, num_lambdas);
+}
+
+//
+// Band Cut
+//
+
+//
+// Capacities of one tile of a band graph
+//
+// Only foreground voxels are nodes of the cut, every other node of the
+// tile keeps zero capacities. An edge from a foreground voxel to a voxel
+// outside the tile or to a fixed voxel becomes a source edge if that voxel
+// is inside and a sink edge otherwise. Returns the number of free nodes.
+//
+template<typename TCap, typename NCap, typename W = typename NeighbourWeight<NCap>::type>
+static uint64_t assemble_band_caps(CutCaps<TCap, NCap>& caps, const SparseVoxelGraph& vgraph,
+                                   const std::vector<uint64_t>& inside, const CutRegion& region,
+                                   double lambda, double mju, int num_threads)
+{
+  const uint32_t width = vgraph.width;
+  const double voxel_h = vgraph.voxel_size;
+  const double wb = lambda * voxel_h * voxel_h * voxel_h;
+  const double wn = 4.0 / 3.0 * M_PI * voxel_h * voxel_h;
+  const uint32_t size[3] = { region.w, region.h, region.d };
+  const uint32_t origin[3] = { region.x0, region.y0, region.z0 };
+
+  uint8_t local[CUT_BRICK_VOXELS][3];
+  for (uint32_t k = 0; k < CUT_BRICK_VOXELS; ++k) {
     uint32_t x, y, z;
-    morton_decode(m, x, y, z);
+    morton_decode(k, x, y, z);
+    local[k][0] = x, local[k][1] = y, local[k][2] = z;
+  }
+
+  uint32_t nb[3];
+  for (int axis = 0; axis < 3; ++axis)
+    nb[axis] = (size[axis] + CUT_BRICK_WIDTH - 1) / CUT_BRICK_WIDTH;
+  const uint64_t num_bricks = (uint64_t)nb[0] * nb[1] * nb[2];
+
+  NCap* ncaps[3] = { caps.gee(), caps.ege(), caps.eeg() };
+  std::atomic<uint64_t> num_free(0);
+
+  ThreadPool pool(num_threads);
+  pool.parallel_for(0, num_bricks, 1, [&](uint64_t b0, uint64_t b1, int) {
+    W edges[3][CUT_BRICK_VOXELS];
+    W ncap[3][CUT_BRICK_VOXELS];
+
+    for (uint64_t b = b0; b < b1; ++b) {
+      const uint32_t bp[3] = {
+        (uint32_t)(b % nb[0]) * CUT_BRICK_WIDTH,
+        (uint32_t)(b / nb[0] % nb[1]) * CUT_BRICK_WIDTH,
+        (uint32_t)(b / nb[0] / nb[1]) * CUT_BRICK_WIDTH
+      };
+      const uint64_t m0 = morton_encode(origin[0] + bp[0], origin[1] + bp[1], origin[2] + bp[2]);
+      const SparseVoxelGraph::Brick* brick = vgraph.brick(m0);
+      if (!brick)
+        continue; // no free voxel
+
+      for (int axis = 0; axis < 3; ++axis) {
+        for (uint32_t k = 0; k < CUT_BRICK_VOXELS; ++k)
+          edges[axis][k] = (W)brick->edges[axis][k];
+        exp_caps(ncap[axis], edges[axis], CUT_BRICK_VOXELS, (W)mju, (W)wn);
+      }
 
-    if (x < vgraph.width-1) {
-      int n1 = graph.node_id(x,y,z), n2 = graph.node_id(x+1,y,z);
-      double w = wn * exp(-mju * vgraph.x_edges[m]);
-      graph.set_neighbor_cap(n1,1,0,0, w);
-      graph.set_neighbor_cap(n2,-1,0,0, w);
+      uint64_t count = 0;
+      for (uint32_t k = 0; k < CUT_BRICK_VOXELS; ++k) {
+        if (!((brick->foreground[k >> 6] >> (k & 63)) & 0x1))
+          continue;
+
+        uint32_t q[3], p[3];
+        for (int axis = 0; axis < 3; ++axis) {
+          q[axis] = bp[axis] + local[k][axis];
+          p[axis] = origin[axis] + q[axis];
+        }
+        if (q[0] >= size[0] || q[1] >= size[1] || q[2] >= size[2])
+          continue;
+
+        const uint64_t i = q[0] + caps.dy * q[1] + caps.dz * q[2];
+        double source = wb, sink = 0.0;
+        for (int axis = 0; axis < 3; ++axis) {
+          uint32_t r[3] = { p[0], p[1], p[2] };
+          if (p[axis] + 1 < width) {
+            r[axis] = p[axis] + 1;
+            const uint64_t n = morton_encode(r[0], r[1], r[2]);
+            if (q[axis] + 1 < size[axis] && vgraph.foreground(n))
+              ncaps[axis][i] = CapType<NCap>::convert(ncap[axis][k], caps.scale);
+            else if (test_bit(inside, n))
+              source += ncap[axis][k];
+            else
+              sink += ncap[axis][k];
+          }
+          if (p[axis] > 0) {
+            r[axis] = p[axis] - 1;
+            const uint64_t n = morton_encode(r[0], r[1], r[2]);
+            if (q[axis] > 0 && vgraph.foreground(n))
+              continue; // stored by the neighbour
+            W e = (W)edge_weight(vgraph, axis, n);
+            double c = wn * neighbour_exp(e, mju);
+            if (test_bit(inside, n))
+              source += c;
+            else
+              sink += c;
+          }
+        }
+        caps.source[i] = CapType<TCap>::convert(source, caps.scale);
+        caps.sink[i] = CapType<TCap>::convert(sink, caps.scale);
+        ++count;
+      }
+      num_free += count;
     }
-    if (y < vgraph.width-1) {
-      int n1 = graph.node_id(x,y,z), n2 = graph.node_id(x,y+1,z);
-      double w = wn * exp(-mju * vgraph.y_edges[m]);
-      graph.set_neighbor_cap(n1,0,1,0, w);
-      graph.set_neighbor_cap(n2,0,-1,0, w);
+  });
+  return num_free;
+}
+
+template<typename TCap, typename NCap, typename Flow>
+static void solve_band_tile(const SparseVoxelGraph& vgraph, std::vector<uint64_t>& inside,
+                            const CutRegion& tile, double lambda, double mju,
+                            const GraphCutOptions& options, double scale)
+{
+  CutCaps<TCap, NCap> caps(tile, scale);
+  uint64_t num_free = assemble_band_caps(caps, vgraph, inside, tile, lambda, mju,
+                                         options.num_threads);
+  printf("tile %u x %u x %u at (%u, %u, %u): %llu free voxels\n",
+         tile.w, tile.h, tile.d, tile.x0, tile.y0, tile.z0,
+         (unsigned long long)num_free);
+  if (num_free == 0)
+    return;
+
+  std::vector<bool> source;
+  maxflow<TCap, NCap, Flow>(caps, tile.w, tile.h, tile.d, options, source);
+
+  uint64_t i = 0;
+  for (uint32_t z = 0; z < tile.d; ++z) {
+    for (uint32_t y = 0; y < tile.h; ++y) {
+      for (uint32_t x = 0; x < tile.w; ++x, ++i) {
+        uint64_t m = morton_encode(tile.x0 + x, tile.y0 + y, tile.z0 + z);
+        if (vgraph.foreground(m))
+          assign_bit(inside, m, source[i]);
+      }
     }
-    if (z < vgraph.width-1) {
-      int n1 = graph.node_id(x,y,z), n2 = graph.node_id(x,y,z+1);
-      double w = wn * exp(-mju * vgraph.z_edges[m]);
-      graph.set_neighbor_cap(n1,0,0,1, w);
-      graph.set_neighbor_cap(n2,0,0,-1, w);
+  }
+}
+
+void graph_cut_band(const SparseVoxelGraph& graph, std::vector<uint64_t>& inside,
+                    double lambda, double mju, uint32_t tile_size,
+                    const GraphCutOptions& options)
+{
+  CutRegion bounds = cut_region(graph);
+  if (bounds.w == 0)
+    return;
+
+  // tiles start on brick boundaries
+  tile_size = std::max(CUT_BRICK_WIDTH, tile_size & ~(CUT_BRICK_WIDTH - 1));
+  const uint32_t size[3] = { bounds.w, bounds.h, bounds.d };
+  uint32_t nt[3];
+  for (int axis = 0; axis < 3; ++axis)
+    nt[axis] = (size[axis] + tile_size - 1) / tile_size;
+  printf("band cut: %u x %u x %u in %u tiles\n",
+         bounds.w, bounds.h, bounds.d, nt[0] * nt[1] * nt[2]);
+
+  for (uint32_t tz = 0; tz < nt[2]; ++tz) {
+    for (uint32_t ty = 0; ty < nt[1]; ++ty) {
+      for (uint32_t tx = 0; tx < nt[0]; ++tx) {
+        const uint32_t t[3] = { tx * tile_size, ty * tile_size, tz * tile_size };
+        CutRegion tile = {
+          bounds.x0 + t[0], bounds.y0 + t[1], bounds.z0 + t[2],
+          std::min(tile_size, size[0] - t[0]),
+          std::min(tile_size, size[1] - t[1]),
+          std::min(tile_size, size[2] - t[2])
+        };
+
+        switch (options.capacity) {
+        case CapacityType::Float:
+          solve_band_tile<float, float, double>(graph, inside, tile, lambda, mju, options, 1.0);
+          break;
+        case CapacityType::Int:
+          solve_band_tile<int32_t, int32_t, int64_t>(graph, inside, tile, lambda, mju, options,
+                                                     int_capacity_scale(graph.voxel_size, lambda));
+          break;
+        default:
+          solve_band_tile<double, double, double>(graph, inside, tile, lambda, mju, options, 1.0);
+          break;
+        }
+      }
     }
   }
+}
 
-  // Maximum Flow
-  graph.compute_maxflow();
-  printf("flow = %lf\n", graph.get_flow());
+//
+// Parametric Cut
+//
 
-  // Export Result
-  QList<uint64_t> result;
-  int w = vgraph.width, h = vgraph.width, d = vgraph.width;
-  for (int x = 0; x < w; ++x) {
-    for (int y = 0; y < h; ++y) {
-      for (int z = 0; z < d; ++z) {
-        bool surface =
-          (x == 0 || graph.get_segment(graph.node_id(x-1,y,z)) == 1) ||
-          (x == w-1 || graph.get_segment(graph.node_id(x+1,y,z)) == 1) ||
-          (y == 0 || graph.get_segment(graph.node_id(x,y-1,z)) == 1) ||
-          (y == h-1 || graph.get_segment(graph.node_id(x,y+1,z)) == 1) ||
-          (z == 0 || graph.get_segment(graph.node_id(x,y,z-1)) == 1) ||
-          (z == d-1 || graph.get_segment(graph.node_id(x,y,z+1)) == 1);
-
-        if (graph.get_segment(graph.node_id(x, y, z)) == 0 && surface) {
-          result.append(morton_encode(x, y, z));
+//
+// Capacities at lambda = 1 (the source capacity of a foreground voxel is
+// then h^3 and scales linearly) and the source set of every solved lambda
+//
+// Neighbour capacities are stored in double for every mode, but computed
+// in the precision graph_cut() uses for it (NeighbourWeight). For Int they
+// are rounded once at a scale fixed for every lambda, so the sums of a
+// band are exact and the rounded problems of all lambdas nest.
+//
+struct ParametricGraphCut::State {
+  CutRegion region;
+  GraphCutOptions options;
+  double scale; // of the sink and neighbour capacities, 1 unless Int
+  CutCaps<double, double> caps;
+  std::map<double, std::vector<bool> > sources;
+
+  State(const CutRegion& region, const GraphCutOptions& options, double scale)
+  : region(region), options(options), scale(scale), caps(region, 1.0) {}
+};
+
+// Source capacity of node i in the units of the stored capacities
+static double source_capacity(const ParametricGraphCut::State& state, double lambda, uint64_t i)
+{
+  const double cap = lambda * state.caps.source[i];
+  switch (state.options.capacity) {
+  case CapacityType::Float:
+    return (float)cap;
+  case CapacityType::Int:
+    return CapType<int32_t>::convert(cap, state.scale);
+  default:
+    return cap;
+  }
+}
+
+//
+// Solve lambda on the voxels undecided by the source sets of the closest
+// smaller (lower) and larger (upper) solved lambdas
+//
+// A voxel is undecided if it is in upper but not in lower; without upper
+// every foreground voxel may join the source, without lower none has to.
+// The solver runs on the bounding box of the undecided voxels: their edges
+// to fixed voxels are added to the source or sink capacity, every other
+// node of the box is left without any capacity.
+//
+template<typename TCap, typename NCap, typename Flow>
+static void solve_band(const ParametricGraphCut::State& state, double lambda,
+                       const std::vector<bool>* lower, const std::vector<bool>* upper,
+                       std::vector<bool>& source)
+{
+  const CutRegion& region = state.region;
+  const CutCaps<double, double>& caps = state.caps;
+  const uint32_t size[3] = { region.w, region.h, region.d };
+  const uint64_t stride[3] = { 1, caps.dy, caps.dz };
+  const double* ncaps[3] = { caps.xcap.data() + 1, caps.ycap.data() + caps.dy,
+                             caps.zcap.data() + caps.dz };
+
+  auto undecided = [&](uint64_t i) {
+    return (upper ? (bool)(*upper)[i] : caps.source[i] > 0.0) && !(lower && (*lower)[i]);
+  };
+
+  // Bounding box of the undecided voxels
+  uint32_t lo[3] = { size[0], size[1], size[2] };
+  uint32_t hi[3] = { 0, 0, 0 };
+  uint64_t count = 0;
+  uint64_t i = 0;
+  for (uint32_t z = 0; z < size[2]; ++z) {
+    for (uint32_t y = 0; y < size[1]; ++y) {
+      for (uint32_t x = 0; x < size[0]; ++x, ++i) {
+        if (!undecided(i))
+          continue;
+        const uint32_t q[3] = { x, y, z };
+        for (int axis = 0; axis < 3; ++axis) {
+          lo[axis] = std::min(lo[axis], q[axis]);
+          hi[axis] = std::max(hi[axis], q[axis] + 1);
         }
+        ++count;
       }
     }
   }
 
-  return result;
+  source = (lower ? *lower : std::vector<bool>(caps.source.size(), false));
+  if (count == 0) {
+    printf("band: empty\n");
+    return;
+  }
+
+  const CutRegion band = { lo[0], lo[1], lo[2], hi[0] - lo[0], hi[1] - lo[1], hi[2] - lo[2] };
+  printf("band: %llu undecided voxels in %u x %u x %u\n",
+         (unsigned long long)count, band.w, band.h, band.d);
+
+  // the capacities of the state are already scaled
+  CutCaps<TCap, NCap> bcaps(band, state.scale);
+  NCap* bncaps[3] = { bcaps.gee(), bcaps.ege(), bcaps.eeg() };
+  uint64_t j = 0;
+  for (uint32_t z = lo[2]; z < hi[2]; ++z) {
+    for (uint32_t y = lo[1]; y < hi[1]; ++y) {
+      i = lo[0] + caps.dy * y + caps.dz * z;
+      for (uint32_t x = lo[0]; x < hi[0]; ++x, ++i, ++j) {
+        if (!undecided(i))
+          continue;
+
+        const uint32_t q[3] = { x, y, z };
+        double source_cap = source_capacity(state, lambda, i);
+        double sink_cap = caps.sink[i];
+        for (int axis = 0; axis < 3; ++axis) {
+          if (q[axis] + 1 < size[axis]) {
+            const uint64_t n = i + stride[axis];
+            const double c = ncaps[axis][i];
+            if (undecided(n))
+              bncaps[axis][j] = CapType<NCap>::convert(c, 1.0);
+            else if (lower && (*lower)[n])
+              source_cap += c;
+            else
+              sink_cap += c;
+          }
+          if (q[axis] > 0) {
+            const uint64_t n = i - stride[axis];
+            const double c = ncaps[axis][n];
+            if (undecided(n))
+              continue; // stored by the neighbour
+            if (lower && (*lower)[n])
+              source_cap += c;
+            else
+              sink_cap += c;
+          }
+        }
+        bcaps.source[j] = CapType<TCap>::convert(source_cap, 1.0);
+        bcaps.sink[j] = CapType<TCap>::convert(sink_cap, 1.0);
+      }
+    }
+  }
+
+  std::vector<bool> segment;
+  maxflow<TCap, NCap, Flow>(bcaps, band.w, band.h, band.d, state.options, segment);
+
+  j = 0;
+  for (uint32_t z = lo[2]; z < hi[2]; ++z) {
+    for (uint32_t y = lo[1]; y < hi[1]; ++y) {
+      i = lo[0] + caps.dy * y + caps.dz * z;
+      for (uint32_t x = lo[0]; x < hi[0]; ++x, ++i, ++j) {
+        if (undecided(i))
+          source[i] = segment[j];
+      }
+    }
+  }
+}
+
+// Capacity of the cut between source and the rest (= the maximum flow)
+static double cut_energy(const ParametricGraphCut::State& state, double lambda,
+                         const std::vector<bool>& source)
+{
+  const CutRegion& region = state.region;
+  const CutCaps<double, double>& caps = state.caps;
+  const double* ncaps[3] = { caps.xcap.data() + 1, caps.ycap.data() + caps.dy,
+                             caps.zcap.data() + caps.dz };
+  const uint64_t stride[3] = { 1, caps.dy, caps.dz };
+  const uint32_t size[3] = { region.w, region.h, region.d };
+
+  double energy = 0.0;
+  uint64_t i = 0;
+  for (uint32_t z = 0; z < size[2]; ++z) {
+    for (uint32_t y = 0; y < size[1]; ++y) {
+      for (uint32_t x = 0; x < size[0]; ++x, ++i) {
+        energy += (source[i] ? caps.sink[i] : source_capacity(state, lambda, i));
+        const uint32_t q[3] = { x, y, z };
+        for (int axis = 0; axis < 3; ++axis) {
+          if (q[axis] + 1 < size[axis] && source[i] != source[i + stride[axis]])
+            energy += ncaps[axis][i];
+        }
+      }
+    }
+  }
+  return energy / state.scale;
+}
+
+template<typename Graph>
+static ParametricGraphCut::State* parametric_state(const Graph& vgraph, double mju,
+                                                   const GraphCutOptions& options,
+                                                   double max_lambda)
+{
+  CutRegion region = cut_region(vgraph);
+  if (region.w != vgraph.width || region.h != vgraph.width || region.d != vgraph.width) {
+    printf("cut region: %u x %u x %u at (%u, %u, %u)\n",
+           region.w, region.h, region.d, region.x0, region.y0, region.z0);
+  }
+
+  QElapsedTimer timer;
+  timer.start();
+  const bool quantise = (options.capacity == CapacityType::Int);
+  const double scale = (quantise ? int_capacity_scale(vgraph.voxel_size, max_lambda) : 1.0);
+  ParametricGraphCut::State* state = new ParametricGraphCut::State(region, options, scale);
+  CutCaps<double, double>& caps = state->caps;
+  if (region.w > 0) {
+    if (options.capacity == CapacityType::Double)
+      assemble_caps<double, double, Graph, double>(caps, vgraph, region, 1.0, mju,
+                                                   options.num_threads);
+    else
+      assemble_caps<double, double, Graph, float>(caps, vgraph, region, 1.0, mju,
+                                                  options.num_threads);
+  }
+  if (quantise) {
+    auto to_int = [scale](std::vector<double>& v) {
+      for (double& c : v)
+        c = (isinf(c) ? CapType<int32_t>::infinity() : CapType<int32_t>::convert(c, scale));
+    };
+    to_int(caps.sink);
+    to_int(caps.xcap);
+    to_int(caps.ycap);
+    to_int(caps.zcap);
+  }
+  printf("graph assembly: %.3f s\n", timer.elapsed() / 1000.0);
+  return state;
+}
+
+ParametricGraphCut::ParametricGraphCut(const VoxelGraph& graph, double mju,
+                                       const GraphCutOptions& options, double max_lambda)
+: m_State(parametric_state(graph, mju, options, max_lambda))
+{
+}
+
+ParametricGraphCut::ParametricGraphCut(const MappedVoxelGraph& graph, double mju,
+                                       const GraphCutOptions& options, double max_lambda)
+: m_State(parametric_state(graph, mju, options, max_lambda))
+{
+}
+
+ParametricGraphCut::ParametricGraphCut(const SparseVoxelGraph& graph, double mju,
+                                       const GraphCutOptions& options, double max_lambda)
+: m_State(parametric_state(graph, mju, options, max_lambda))
+{
+}
+
+ParametricGraphCut::~ParametricGraphCut()
+{
+  delete m_State;
+}
+
+int ParametricGraphCut::num_solved() const
+{
+  return (int)m_State->sources.size();
+}
+
+VoxelList ParametricGraphCut::cut(double lambda, double* flow)
+{
+  State& state = *m_State;
+  if (state.region.w == 0) {
+    if (flow)
+      *flow = 0.0;
+    return VoxelList();
+  }
+
+  auto it = state.sources.lower_bound(lambda);
+  if (it == state.sources.end() || it->first != lambda) {
+    const std::vector<bool>* upper = (it != state.sources.end() ? &it->second : nullptr);
+    const std::vector<bool>* lower = (it != state.sources.begin() ? &std::prev(it)->second : nullptr);
+
+    std::vector<bool> source;
+    switch (state.options.capacity) {
+    case CapacityType::Float:
+      solve_band<float, float, double>(state, lambda, lower, upper, source);
+      break;
+    case CapacityType::Int:
+      solve_band<int32_t, int32_t, int64_t>(state, lambda, lower, upper, source);
+      break;
+    default:
+      solve_band<double, double, double>(state, lambda, lower, upper, source);
+      break;
+    }
+    it = state.sources.insert(it, std::make_pair(lambda, std::move(source)));
+  }
+
+  double total = cut_energy(state, lambda, it->second);
+  printf("flow = %lf\n", total);
+  if (flow)
+    *flow = total;
+  return export_surface(it->second, state.region);
 }
 
 #if 0
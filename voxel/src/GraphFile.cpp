@@ -0,0 +1,699 @@
+#include "morton_code.h"
+#include "BuildGraph.h"
+#include "GraphAccess.h"
+
+#include <QFile>
+#include <QTextStream>
+#include <QtDebug>
+#include <algorithm>
+#include <vector>
+#include <string.h>
+
+namespace recon {
+
+// ====================================================================
+// Text Graph File
+
+static bool load_graph_text(VoxelGraph& graph, QFile& file)
+{
+  QTextStream stream(&file);
+
+  stream >> graph.level
+         >> graph.width
+         >> graph.voxel_size
+         >> graph.voxel_minpos[0]
+         >> graph.voxel_minpos[1]
+         >> graph.voxel_minpos[2]
+         >> graph.voxel_maxpos[0]
+         >> graph.voxel_maxpos[1]
+         >> graph.voxel_maxpos[2];
+
+  uint64_t length = (uint64_t)graph.width * graph.width * graph.width;
+  graph.foreground.resize(length, false);
+  graph.x_edges.resize(length, 0.0);
+  graph.y_edges.resize(length, 0.0);
+  graph.z_edges.resize(length, 0.0);
+
+  QString xyz, dir;
+  for (uint64_t i = 0; i < length; ++i) {
+    int x, y, z;
+    int flag;
+    stream >> x >> y >> z >> flag;
+    graph.foreground[morton_encode(x, y, z)] = flag;
+  }
+
+  for (uint64_t i = 0; i < length*3; ++i) {
+    int x, y, z;
+    double w;
+    stream >> x >> y >> z >> w >> dir;
+    if (dir == "+x") {
+      graph.x_edges[morton_encode(x, y, z)] = w;
+    } else if (dir == "+y") {
+      graph.y_edges[morton_encode(x, y, z)] = w;
+    } else if (dir == "+z") {
+      graph.z_edges[morton_encode(x, y, z)] = w;
+    }
+  }
+
+  return true;
+}
+
+template<typename Graph>
+static bool save_graph_text(const Graph& graph, QFile& outfile)
+{
+  QTextStream stream(&outfile);
+  stream.setRealNumberNotation(QTextStream::ScientificNotation);
+  stream.setRealNumberPrecision(15);
+
+  stream << graph.level << "\n"
+         << graph.width << "\n"
+         << graph.voxel_size << "\n"
+         << graph.voxel_minpos[0] << " "
+         << graph.voxel_minpos[1] << " "
+         << graph.voxel_minpos[2] << "\n"
+         << graph.voxel_maxpos[0] << " "
+         << graph.voxel_maxpos[1] << " "
+         << graph.voxel_maxpos[2] << "\n";
+
+  uint64_t length = (uint64_t)graph.width * graph.width * graph.width;
+
+  for (uint64_t m = 0; m < length; ++m) {
+    uint32_t x, y, z;
+    morton_decode(m, x, y, z);
+    stream << x << " " << y << " " << z << " "
+           << is_foreground(graph, m) << "\n";
+  }
+  for (uint64_t m = 0; m < length; ++m) {
+    uint32_t x, y, z;
+    morton_decode(m, x, y, z);
+    stream << x << " " << y << " " << z << " "
+           << edge_weight(graph, 0, m) << " +x\n";
+    stream << x << " " << y << " " << z << " "
+           << edge_weight(graph, 1, m) << " +y\n";
+    stream << x << " " << y << " " << z << " "
+           << edge_weight(graph, 2, m) << " +z\n";
+  }
+
+  stream.flush();
+  outfile.close();
+  return true;
+}
+
+// ====================================================================
+// Binary Graph File
+//
+// Dense layout
+// [GraphFileHeader]
+// [foreground bitset]   uint64_t words, bit (m % 64) of word (m / 64)
+// [x edges]             float or double, Morton order
+// [y edges]
+// [z edges]
+//
+// Sparse layout (version 2)
+// [GraphFileHeader]
+// [brick codes]         uint64_t, ascending
+// [foreground bitset]   BRICK_VOXELS bits per brick
+// [x edges]             BRICK_VOXELS values per brick
+// [y edges]
+// [z edges]
+//
+// Every section starts at a 64-byte aligned offset, so the file can be
+// mapped and read in place.
+//
+
+static const char GRAPH_FILE_MAGIC[8] = { 'R','E','C','O','N','V','G','\0' };
+static const uint32_t GRAPH_FILE_VERSION = 2;
+static const uint32_t GRAPH_FILE_FLOAT_EDGES = 0x1;
+static const uint32_t GRAPH_FILE_SPARSE = 0x2;
+
+struct GraphFileHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t flags;
+  uint32_t level;
+  uint32_t width;
+  float voxel_size;
+  float voxel_minpos[3];
+  float voxel_maxpos[3];
+  uint32_t brick_bits;
+  uint64_t length;
+  uint64_t foreground_offset;
+  uint64_t edges_offset[3];
+  // version 2
+  uint64_t num_bricks;
+  uint64_t bricks_offset;
+};
+
+// size of the version 1 header (no sparse fields)
+static const uint64_t GRAPH_FILE_HEADER_V1_SIZE = 96;
+
+// highest level of a VoxelModel
+static const uint32_t GRAPH_FILE_MAX_LEVEL = 20;
+
+static_assert(sizeof(GraphFileHeader) == 112, "unexpected padding in GraphFileHeader");
+
+static inline uint64_t align64(uint64_t offset)
+{
+  return (offset + 63) & ~0x3Full;
+}
+
+template<typename Graph>
+static void init_header(GraphFileHeader& header, const Graph& graph, bool float_edges)
+{
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, GRAPH_FILE_MAGIC, sizeof(header.magic));
+  header.version = GRAPH_FILE_VERSION;
+  header.flags = (float_edges ? GRAPH_FILE_FLOAT_EDGES : 0);
+  header.level = graph.level;
+  header.width = graph.width;
+  header.voxel_size = graph.voxel_size;
+  memcpy(header.voxel_minpos, graph.voxel_minpos, sizeof(float)*3);
+  memcpy(header.voxel_maxpos, graph.voxel_maxpos, sizeof(float)*3);
+  header.length = (uint64_t)graph.width * graph.width * graph.width;
+}
+
+static inline uint64_t edge_size(const GraphFileHeader& header)
+{
+  return (header.flags & GRAPH_FILE_FLOAT_EDGES ? sizeof(float) : sizeof(double));
+}
+
+// number of voxels stored in every section
+static inline uint64_t stored_voxels(const GraphFileHeader& header)
+{
+  if (header.flags & GRAPH_FILE_SPARSE)
+    return header.num_bricks << header.brick_bits;
+  return header.length;
+}
+
+static void layout_sections(GraphFileHeader& header)
+{
+  uint64_t n = stored_voxels(header);
+  uint64_t offset = align64(sizeof(GraphFileHeader));
+  if (header.flags & GRAPH_FILE_SPARSE) {
+    header.bricks_offset = offset;
+    offset = align64(offset + header.num_bricks * 8);
+  }
+  header.foreground_offset = offset;
+  header.edges_offset[0] = align64(offset + (n + 63) / 64 * 8);
+  header.edges_offset[1] = align64(header.edges_offset[0] + n * edge_size(header));
+  header.edges_offset[2] = align64(header.edges_offset[1] + n * edge_size(header));
+}
+
+// true if count values of unit bytes at offset lie after the header and
+// inside a file of size bytes, without overflowing
+static bool section_fits(uint64_t offset, uint64_t count, uint64_t unit,
+                         uint64_t header_size, uint64_t size)
+{
+  return offset >= header_size && offset == align64(offset) && offset <= size &&
+         count <= (size - offset) / unit;
+}
+
+static bool check_header(const GraphFileHeader& header, uint64_t size)
+{
+  if (memcmp(header.magic, GRAPH_FILE_MAGIC, sizeof(header.magic)) != 0)
+    return false;
+  if (header.version < 1 || header.version > GRAPH_FILE_VERSION ||
+      (header.version < 2 && (header.flags & GRAPH_FILE_SPARSE))) {
+    qDebug() << "Unsupported graph file version:" << header.version;
+    return false;
+  }
+  const bool sparse = (header.flags & GRAPH_FILE_SPARSE) != 0;
+  if (sparse && header.brick_bits != SparseVoxelGraph::BRICK_BITS) {
+    qDebug() << "Unsupported brick size in graph file";
+    return false;
+  }
+
+  // the level bounds length, and length bounds the bricks, so that the
+  // number of stored voxels does not overflow
+  bool ok = header.level <= GRAPH_FILE_MAX_LEVEL &&
+            header.width == (0x1u << header.level) &&
+            header.length == (uint64_t)header.width * header.width * header.width &&
+            (!sparse || header.num_bricks <= std::max<uint64_t>(1, header.length >> header.brick_bits));
+  if (ok) {
+    const uint64_t n = stored_voxels(header);
+    const uint64_t header_size = (header.version < 2 ? GRAPH_FILE_HEADER_V1_SIZE
+                                                     : sizeof(GraphFileHeader));
+    ok = (!sparse || section_fits(header.bricks_offset, header.num_bricks, 8, header_size, size)) &&
+         section_fits(header.foreground_offset, (n + 63) / 64, 8, header_size, size);
+    for (int axis = 0; axis < 3 && ok; ++axis)
+      ok = section_fits(header.edges_offset[axis], n, edge_size(header), header_size, size);
+  }
+  if (!ok) {
+    qDebug() << "Graph file is truncated or corrupted";
+    return false;
+  }
+  return true;
+}
+
+// Brick codes must be ascending, unique and inside the grid: they index
+// the brick table of SparseVoxelGraph::allocate
+static bool check_bricks(const uchar* data, const GraphFileHeader& header)
+{
+  if (!(header.flags & GRAPH_FILE_SPARSE))
+    return true;
+
+  const uint64_t num_codes = std::max<uint64_t>(1, header.length >> header.brick_bits);
+  const uint64_t* codes = (const uint64_t*)(data + header.bricks_offset);
+  for (uint64_t b = 0; b < header.num_bricks; ++b) {
+    if (codes[b] >= num_codes || (b > 0 && codes[b] <= codes[b - 1])) {
+      qDebug() << "Graph file has invalid brick codes";
+      return false;
+    }
+  }
+  return true;
+}
+
+static bool is_binary_graph(QFile& file)
+{
+  char magic[sizeof(GRAPH_FILE_MAGIC)];
+  if (file.peek(magic, sizeof(magic)) != sizeof(magic))
+    return false;
+  return memcmp(magic, GRAPH_FILE_MAGIC, sizeof(magic)) == 0;
+}
+
+// Map a binary graph file opened for reading
+static uchar* map_graph_file(QFile& file, GraphFileHeader& header)
+{
+  uint64_t size = (uint64_t)file.size();
+  if (size < GRAPH_FILE_HEADER_V1_SIZE || !is_binary_graph(file))
+    return nullptr;
+
+  uchar* data = file.map(0, file.size());
+  if (!data) {
+    qDebug() << "Cannot map graph file: " << file.fileName();
+    return nullptr;
+  }
+
+  // version 1 headers end before the sparse fields
+  memset(&header, 0, sizeof(header));
+  memcpy(&header, data, std::min<uint64_t>(size, sizeof(header)));
+  if (header.version < 2) {
+    header.num_bricks = 0;
+    header.bricks_offset = 0;
+  }
+  if (!check_header(header, size) || !check_bricks(data, header)) {
+    file.unmap(data);
+    return nullptr;
+  }
+  return data;
+}
+
+// pad the file up to the next 64-byte boundary
+static bool write_padding(QFile& file)
+{
+  static const char zeros[64] = { 0 };
+  qint64 pad = (qint64)(align64(file.pos()) - file.pos());
+  return (pad == 0 || file.write(zeros, pad) == pad);
+}
+
+static bool write_bytes(QFile& file, const void* data, uint64_t size)
+{
+  const char* ptr = (const char*)data;
+  while (size > 0) {
+    qint64 chunk = (qint64)std::min<uint64_t>(size, 0x1ull << 30);
+    if (file.write(ptr, chunk) != chunk)
+      return false;
+    ptr += chunk, size -= chunk;
+  }
+  return true;
+}
+
+template<typename T>
+static bool write_values(QFile& file, const double* values, uint64_t n)
+{
+  if (sizeof(T) == sizeof(double))
+    return write_bytes(file, values, n * sizeof(double));
+
+  // convert in chunks to keep the scratch buffer small
+  std::vector<T> buffer;
+  const uint64_t chunk = 0x1ull << 20;
+  for (uint64_t i = 0; i < n; i += chunk) {
+    uint64_t i1 = std::min(n, i + chunk);
+    buffer.assign(values + i, values + i1);
+    if (!write_bytes(file, buffer.data(), (i1 - i) * sizeof(T)))
+      return false;
+  }
+  return true;
+}
+
+static bool save_graph_binary(const VoxelGraph& graph, QFile& file, bool float_edges)
+{
+  GraphFileHeader header;
+  init_header(header, graph, float_edges);
+  layout_sections(header);
+
+  std::vector<uint64_t> bits((header.length + 63) / 64, 0);
+  for (uint64_t m = 0; m < header.length; ++m) {
+    if (graph.foreground[m])
+      bits[m >> 6] |= (0x1ull << (m & 63));
+  }
+
+  if (!write_bytes(file, &header, sizeof(header)) || !write_padding(file) ||
+      !write_bytes(file, bits.data(), bits.size() * 8) || !write_padding(file))
+    return false;
+
+  const std::vector<double>* edges[3] = {
+    &graph.x_edges, &graph.y_edges, &graph.z_edges
+  };
+  for (int axis = 0; axis < 3; ++axis) {
+    const double* values = edges[axis]->data();
+    bool ok = (float_edges ? write_values<float>(file, values, header.length)
+                           : write_values<double>(file, values, header.length));
+    if (!ok || !write_padding(file))
+      return false;
+  }
+  return true;
+}
+
+static bool save_graph_binary(const SparseVoxelGraph& graph, QFile& file, bool float_edges)
+{
+  typedef SparseVoxelGraph::Brick Brick;
+  const uint64_t nbricks = graph.bricks.size();
+
+  GraphFileHeader header;
+  init_header(header, graph, float_edges);
+  header.flags |= GRAPH_FILE_SPARSE;
+  header.brick_bits = SparseVoxelGraph::BRICK_BITS;
+  header.num_bricks = nbricks;
+  layout_sections(header);
+
+  if (!write_bytes(file, &header, sizeof(header)) || !write_padding(file) ||
+      !write_bytes(file, graph.brick_codes.data(), nbricks * 8) || !write_padding(file))
+    return false;
+
+  for (const Brick& b : graph.bricks) {
+    if (!write_bytes(file, b.foreground, sizeof(b.foreground)))
+      return false;
+  }
+  if (!write_padding(file))
+    return false;
+
+  for (int axis = 0; axis < 3; ++axis) {
+    for (const Brick& b : graph.bricks) {
+      const uint64_t n = SparseVoxelGraph::BRICK_VOXELS;
+      bool ok = (float_edges ? write_values<float>(file, b.edges[axis], n)
+                             : write_values<double>(file, b.edges[axis], n));
+      if (!ok)
+        return false;
+    }
+    if (!write_padding(file))
+      return false;
+  }
+  return true;
+}
+
+// Read the voxel at index i of a section
+static inline bool stored_foreground(const uchar* data, const GraphFileHeader& header, uint64_t i)
+{
+  const uint64_t* bits = (const uint64_t*)(data + header.foreground_offset);
+  return (bits[i >> 6] >> (i & 63)) & 0x1;
+}
+
+static inline double stored_edge(const uchar* data, const GraphFileHeader& header, int axis, uint64_t i)
+{
+  const uchar* ptr = data + header.edges_offset[axis];
+  if (header.flags & GRAPH_FILE_FLOAT_EDGES)
+    return ((const float*)ptr)[i];
+  return ((const double*)ptr)[i];
+}
+
+template<typename Graph>
+static void copy_attributes(Graph& graph, const GraphFileHeader& header)
+{
+  graph.level = header.level;
+  graph.width = header.width;
+  graph.voxel_size = header.voxel_size;
+  memcpy(graph.voxel_minpos, header.voxel_minpos, sizeof(float)*3);
+  memcpy(graph.voxel_maxpos, header.voxel_maxpos, sizeof(float)*3);
+}
+
+static void load_graph_binary(VoxelGraph& graph, const uchar* data, const GraphFileHeader& header)
+{
+  copy_attributes(graph, header);
+
+  const uint64_t length = header.length;
+  graph.foreground.assign(length, false);
+  graph.x_edges.assign(length, 0.0);
+  graph.y_edges.assign(length, 0.0);
+  graph.z_edges.assign(length, 0.0);
+  std::vector<double>* edges[3] = {
+    &graph.x_edges, &graph.y_edges, &graph.z_edges
+  };
+
+  if (header.flags & GRAPH_FILE_SPARSE) {
+    const uint64_t* codes = (const uint64_t*)(data + header.bricks_offset);
+    const uint64_t bsize = SparseVoxelGraph::BRICK_VOXELS;
+    for (uint64_t b = 0; b < header.num_bricks; ++b) {
+      for (uint64_t k = 0; k < bsize; ++k) {
+        uint64_t i = b * bsize + k;
+        uint64_t m = (codes[b] << SparseVoxelGraph::BRICK_BITS) + k;
+        if (m >= length)
+          break;
+        graph.foreground[m] = stored_foreground(data, header, i);
+        for (int axis = 0; axis < 3; ++axis)
+          (*edges[axis])[m] = stored_edge(data, header, axis, i);
+      }
+    }
+  } else {
+    for (uint64_t m = 0; m < length; ++m)
+      graph.foreground[m] = stored_foreground(data, header, m);
+    for (int axis = 0; axis < 3; ++axis) {
+      std::vector<double>& e = *edges[axis];
+      for (uint64_t m = 0; m < length; ++m)
+        e[m] = stored_edge(data, header, axis, m);
+    }
+  }
+}
+
+// Keep the bricks of a dense graph holding the hull or a non-zero edge
+template<typename Graph>
+static void sparsify(SparseVoxelGraph& sparse, const Graph& dense)
+{
+  typedef SparseVoxelGraph::Brick Brick;
+  const uint64_t bsize = SparseVoxelGraph::BRICK_VOXELS;
+  const uint64_t length = (uint64_t)dense.width * dense.width * dense.width;
+
+  sparse.level = dense.level;
+  sparse.width = dense.width;
+  sparse.voxel_size = dense.voxel_size;
+  memcpy(sparse.voxel_minpos, dense.voxel_minpos, sizeof(float)*3);
+  memcpy(sparse.voxel_maxpos, dense.voxel_maxpos, sizeof(float)*3);
+
+  std::vector<uint64_t> codes;
+  for (uint64_t m0 = 0; m0 < length; m0 += bsize) {
+    uint64_t m1 = std::min(length, m0 + bsize);
+    bool used = false;
+    for (uint64_t m = m0; m < m1 && !used; ++m) {
+      used = is_foreground(dense, m) ||
+             edge_weight(dense, 0, m) != 0.0 ||
+             edge_weight(dense, 1, m) != 0.0 ||
+             edge_weight(dense, 2, m) != 0.0;
+    }
+    if (used)
+      codes.push_back(m0 >> SparseVoxelGraph::BRICK_BITS);
+  }
+
+  sparse.allocate(codes);
+  for (size_t b = 0; b < codes.size(); ++b) {
+    Brick& brick = sparse.bricks[b];
+    uint64_t m0 = codes[b] << SparseVoxelGraph::BRICK_BITS;
+    uint64_t m1 = std::min(length, m0 + bsize);
+    for (uint64_t m = m0; m < m1; ++m) {
+      uint64_t k = m - m0;
+      if (is_foreground(dense, m))
+        brick.foreground[k >> 6] |= (0x1ull << (k & 63));
+      for (int axis = 0; axis < 3; ++axis)
+        brick.edges[axis][k] = edge_weight(dense, axis, m);
+    }
+  }
+}
+
+static void load_graph_binary(SparseVoxelGraph& graph, const uchar* data, const GraphFileHeader& header)
+{
+  typedef SparseVoxelGraph::Brick Brick;
+
+  if (!(header.flags & GRAPH_FILE_SPARSE)) {
+    MappedVoxelGraph dense;
+    copy_attributes(dense, header);
+    dense.length = header.length;
+    dense.float_edges = (header.flags & GRAPH_FILE_FLOAT_EDGES) != 0;
+    dense.foreground_bits = (const uint64_t*)(data + header.foreground_offset);
+    for (int axis = 0; axis < 3; ++axis)
+      dense.edges[axis] = data + header.edges_offset[axis];
+    sparsify(graph, dense);
+    return;
+  }
+
+  copy_attributes(graph, header);
+
+  const uint64_t* codes = (const uint64_t*)(data + header.bricks_offset);
+  graph.allocate(std::vector<uint64_t>(codes, codes + header.num_bricks));
+
+  const uint64_t bsize = SparseVoxelGraph::BRICK_VOXELS;
+  for (uint64_t b = 0; b < header.num_bricks; ++b) {
+    Brick& brick = graph.bricks[b];
+    memcpy(brick.foreground,
+           data + header.foreground_offset + b * sizeof(brick.foreground),
+           sizeof(brick.foreground));
+    for (int axis = 0; axis < 3; ++axis) {
+      for (uint64_t k = 0; k < bsize; ++k)
+        brick.edges[axis][k] = stored_edge(data, header, axis, b * bsize + k);
+    }
+  }
+}
+
+// ====================================================================
+
+bool load_graph(VoxelGraph& graph, const QString& path)
+{
+  QFile file(path);
+  if (!file.open(QIODevice::ReadOnly)) {
+    qDebug() << "Cannot open graph file!";
+    return false;
+  }
+
+  if (!is_binary_graph(file))
+    return load_graph_text(graph, file);
+
+  GraphFileHeader header;
+  uchar* data = map_graph_file(file, header);
+  if (!data)
+    return false;
+  load_graph_binary(graph, data, header);
+  file.unmap(data);
+  return true;
+}
+
+bool load_graph(SparseVoxelGraph& graph, const QString& path)
+{
+  QFile file(path);
+  if (!file.open(QIODevice::ReadOnly)) {
+    qDebug() << "Cannot open graph file!";
+    return false;
+  }
+
+  if (!is_binary_graph(file)) {
+    VoxelGraph dense;
+    if (!load_graph_text(dense, file))
+      return false;
+    sparsify(graph, dense);
+    return true;
+  }
+
+  GraphFileHeader header;
+  uchar* data = map_graph_file(file, header);
+  if (!data)
+    return false;
+  load_graph_binary(graph, data, header);
+  file.unmap(data);
+  return true;
+}
+
+bool load_graph(MappedVoxelGraph& graph, const QString& path)
+{
+  if (!graph.map(path)) {
+    qDebug() << "Cannot map graph file (dense binary graphs only): " << path;
+    return false;
+  }
+  return true;
+}
+
+template<typename Graph>
+static bool save_graph_file(const Graph& graph, const QString& path, GraphFormat format)
+{
+  QFile outfile(path);
+  QIODevice::OpenMode mode = QIODevice::WriteOnly | QIODevice::Truncate;
+  if (format == GraphFormat::Text)
+    mode |= QIODevice::Text;
+  if (!outfile.open(mode)) {
+    qDebug() << "Cannot open output file: " << path;
+    return false;
+  }
+
+  bool ok;
+  switch (format) {
+  case GraphFormat::Text:
+    ok = save_graph_text(graph, outfile);
+    break;
+  case GraphFormat::BinaryFloat:
+    ok = save_graph_binary(graph, outfile, true);
+    break;
+  default:
+    ok = save_graph_binary(graph, outfile, false);
+    break;
+  }
+  if (!ok)
+    qDebug() << "Cannot write graph file: " << path;
+  return ok;
+}
+
+bool save_graph(const VoxelGraph& graph, const QString& path, GraphFormat format)
+{
+  return save_graph_file(graph, path, format);
+}
+
+bool save_graph(const SparseVoxelGraph& graph, const QString& path, GraphFormat format)
+{
+  return save_graph_file(graph, path, format);
+}
+
+// ====================================================================
+
+MappedVoxelGraph::MappedVoxelGraph()
+: level(0)
+, width(0)
+, voxel_size(0.0f)
+, length(0)
+, float_edges(false)
+, foreground_bits(nullptr)
+, m_Data(nullptr)
+{
+  memset(voxel_minpos, 0, sizeof(voxel_minpos));
+  memset(voxel_maxpos, 0, sizeof(voxel_maxpos));
+  edges[0] = edges[1] = edges[2] = nullptr;
+}
+
+MappedVoxelGraph::~MappedVoxelGraph()
+{
+  unmap();
+}
+
+bool MappedVoxelGraph::map(const QString& path)
+{
+  unmap();
+
+  m_File.setFileName(path);
+  if (!m_File.open(QIODevice::ReadOnly)) {
+    qDebug() << "Cannot open graph file!";
+    return false;
+  }
+
+  GraphFileHeader header;
+  m_Data = map_graph_file(m_File, header);
+  if (!m_Data || (header.flags & GRAPH_FILE_SPARSE)) {
+    unmap();
+    return false;
+  }
+
+  copy_attributes(*this, header);
+  length = header.length;
+  float_edges = (header.flags & GRAPH_FILE_FLOAT_EDGES) != 0;
+  foreground_bits = (const uint64_t*)(m_Data + header.foreground_offset);
+  for (int axis = 0; axis < 3; ++axis)
+    edges[axis] = m_Data + header.edges_offset[axis];
+  return true;
+}
+
+void MappedVoxelGraph::unmap()
+{
+  if (m_Data) {
+    m_File.unmap(m_Data);
+    m_Data = nullptr;
+  }
+  if (m_File.isOpen())
+    m_File.close();
+  foreground_bits = nullptr;
+  edges[0] = edges[1] = edges[2] = nullptr;
+}
+
+}
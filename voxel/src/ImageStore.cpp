@@ -0,0 +1,221 @@
+#include "ImageStore.h"
+#include "ThreadPool.h"
+#include <QElapsedTimer>
+#include <algorithm>
+
+namespace recon {
+
+GrayImage::GrayImage()
+: width(0), height(0), stride(0)
+{
+}
+
+GrayImage::GrayImage(int w, int h)
+: width(w), height(h)
+, stride((w + 2 * PAD + 3) & ~3)
+, plane((uint64_t)stride * (h + 2 * PAD), 0.0f)
+{
+}
+
+GrayImage::GrayImage(const QImage& image)
+: GrayImage(image.width(), image.height())
+{
+  // same weights as RGB_TO_GRAY, on colors normalized to 0.0 - 1.0
+  QImage rgb = image.convertToFormat(QImage::Format_RGB32);
+  for (int y = 0; y < height; ++y) {
+    const QRgb* src = (const QRgb*)rgb.constScanLine(y);
+    float* dst = row(y);
+    for (int x = 0; x < width; ++x) {
+      QRgb c = src[x];
+      dst[x] = (0.299f * (float)qRed(c) +
+                0.587f * (float)qGreen(c) +
+                0.114f * (float)qBlue(c)) / 255.0f;
+    }
+  }
+  fill_padding();
+}
+
+void GrayImage::fill_padding()
+{
+  if (width == 0 || height == 0)
+    return;
+
+  for (int y = 0; y < height; ++y) {
+    float* r = row(y);
+    std::fill(r - PAD, r, r[0]);
+    std::fill(r + width, r + width + PAD, r[width - 1]);
+  }
+  const float* top = row(0) - PAD;
+  const float* bottom = row(height - 1) - PAD;
+  for (int y = 1; y <= PAD; ++y) {
+    std::copy(top, top + width + 2 * PAD, row(-y) - PAD);
+    std::copy(bottom, bottom + width + 2 * PAD, row(height - 1 + y) - PAD);
+  }
+}
+
+GrayImage GrayImage::downsampled() const
+{
+  GrayImage half(std::max(1, width / 2), std::max(1, height / 2));
+  for (int y = 0; y < half.height; ++y) {
+    const float* r0 = row(std::min(2 * y, height - 1));
+    const float* r1 = row(std::min(2 * y + 1, height - 1));
+    float* dst = half.row(y);
+    for (int x = 0; x < half.width; ++x) {
+      int x0 = std::min(2 * x, width - 1), x1 = std::min(2 * x + 1, width - 1);
+      dst[x] = 0.25f * (r0[x0] + r0[x1] + r1[x0] + r1[x1]);
+    }
+  }
+  half.fill_padding();
+  return half;
+}
+
+ImageStore::ImageStore(int num_levels)
+: ImageStore(num_levels, Loader(), 0)
+{
+}
+
+ImageStore::ImageStore(int num_levels, Loader loader, uint64_t budget)
+: m_NumLevels(std::max(1, num_levels))
+, m_Loader(loader)
+, m_Budget(budget)
+, m_Clock(0)
+, m_ResidentBytes(0)
+, m_NumLoads(0)
+, m_ConvertNsecs(0)
+{
+}
+
+ImageStore::~ImageStore()
+{
+  for (View& v : m_Views)
+    delete v.levels.load();
+}
+
+std::vector<GrayImage>* ImageStore::convert(const QImage& image) const
+{
+  std::vector<GrayImage>* levels = new std::vector<GrayImage>();
+  levels->reserve(m_NumLevels);
+  levels->push_back(GrayImage(image));
+  for (int i = 1; i < m_NumLevels; ++i)
+    levels->push_back(levels->back().downsampled());
+  return levels;
+}
+
+uint64_t ImageStore::bytes(const std::vector<GrayImage>& levels)
+{
+  uint64_t sum = 0;
+  for (const GrayImage& level : levels)
+    sum += level.plane.size() * sizeof(float);
+  return sum;
+}
+
+void ImageStore::append(const QImage& image)
+{
+  m_Views.push_back(View(image.width(), image.height()));
+  std::vector<GrayImage>* levels = convert(image);
+  m_ResidentBytes += bytes(*levels);
+  // never evicted
+  m_Views.back().pins = 1;
+  m_Views.back().levels.store(levels);
+}
+
+void ImageStore::append(int width, int height)
+{
+  m_Views.push_back(View(width, height));
+}
+
+void ImageStore::append()
+{
+  m_Views.push_back(View(0, 0));
+}
+
+void ImageStore::load_all(int num_threads)
+{
+  ThreadPool pool(num_threads);
+  pool.run(m_Views.size(), [this](uint64_t view, int) {
+    pin((int)view);
+    unpin((int)view);
+  });
+}
+
+void ImageStore::pin(int view) const
+{
+  if (!m_Loader)
+    return; // every view is resident
+  View& v = m_Views[view];
+  if (m_Budget == 0 && v.levels.load(std::memory_order_acquire))
+    return; // never dropped
+  std::unique_lock<std::mutex> lock(m_Mutex);
+  v.pins++;
+  v.last_use = ++m_Clock;
+  while (v.loading)
+    m_Loaded.wait(lock);
+  if (v.levels.load(std::memory_order_relaxed))
+    return;
+
+  // decoded without the lock, other threads pinning it wait for it
+  v.loading = true;
+  lock.unlock();
+  QImage image = m_Loader(view);
+  QElapsedTimer timer;
+  timer.start();
+  if (v.width == 0 && v.height == 0)
+    v.width = image.width(), v.height = image.height();
+  else if (image.size() != QSize(v.width, v.height))
+    image = image.scaled(v.width, v.height, Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
+  std::vector<GrayImage>* levels = convert(image);
+  image = QImage();
+  m_ConvertNsecs += timer.nsecsElapsed();
+  lock.lock();
+
+  v.levels.store(levels, std::memory_order_release);
+  v.loading = false;
+  m_ResidentBytes += bytes(*levels);
+  m_NumLoads++;
+  evict();
+  m_Loaded.notify_all();
+}
+
+void ImageStore::unpin(int view) const
+{
+  if (!m_Loader || m_Budget == 0)
+    return;
+  std::lock_guard<std::mutex> lock(m_Mutex);
+  m_Views[view].pins--;
+}
+
+void ImageStore::evict() const
+{
+  while (m_Budget > 0 && m_ResidentBytes > m_Budget) {
+    View* lru = nullptr;
+    for (View& v : m_Views) {
+      if (v.pins == 0 && v.levels.load(std::memory_order_relaxed) &&
+          (!lru || v.last_use < lru->last_use))
+        lru = &v;
+    }
+    if (!lru)
+      return;
+    std::vector<GrayImage>* levels = lru->levels.exchange(nullptr);
+    m_ResidentBytes -= bytes(*levels);
+    delete levels;
+  }
+}
+
+uint64_t ImageStore::resident_bytes() const
+{
+  std::lock_guard<std::mutex> lock(m_Mutex);
+  return m_ResidentBytes;
+}
+
+int ImageStore::num_loads() const
+{
+  std::lock_guard<std::mutex> lock(m_Mutex);
+  return m_NumLoads;
+}
+
+double ImageStore::convert_seconds() const
+{
+  return m_ConvertNsecs.load() * 1e-9;
+}
+
+}
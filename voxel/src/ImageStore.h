@@ -0,0 +1,183 @@
+#pragma once
+
+#include <QImage>
+#include <QList>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+namespace recon {
+
+//
+// Single-channel float image (gray in 0.0 - 1.0)
+//
+// The plane is padded by PAD pixels on every side that repeat the border
+// pixels, so windows reaching over the edge read the same values as with
+// clamped coordinates and need no checks. Rows are a multiple of 4 floats.
+//
+struct GrayImage {
+  static const int PAD = 8;
+
+  int width;
+  int height;
+  int stride; // floats per row, padding included
+  std::vector<float> plane;
+
+  GrayImage();
+  explicit GrayImage(const QImage& image);
+  GrayImage(int w, int h);
+
+  // Pixel (0, y), y and the returned pointer may step PAD pixels outside
+  inline const float* row(int y) const
+  {
+    return plane.data() + (uint64_t)(y + PAD) * stride + PAD;
+  }
+
+  inline float* row(int y)
+  {
+    return plane.data() + (uint64_t)(y + PAD) * stride + PAD;
+  }
+
+  inline bool valid(int x, int y) const
+  {
+    return x >= 0 && y >= 0 && x < width && y < height;
+  }
+
+  // Copy the border pixels into the padding
+  void fill_padding();
+
+  // Half size, 2x2 box filter
+  GrayImage downsampled() const;
+};
+
+//
+// Gray planes of every view, converted once when loaded
+//
+// Level 0 has the size of the loaded image, every further level is half
+// the size of the one before.
+//
+// Views appended with their size only are decoded by the loader when they
+// are first pinned. Once the planes of the resident views take more than
+// the budget, the least recently pinned views that are not pinned any more
+// are dropped, and decoded again when needed. The budget is exceeded only
+// while more views than fit in it are pinned at once. Without a budget the
+// views are never dropped and pinning a resident view takes no lock.
+//
+class ImageStore {
+public:
+  // Decodes a view, called from the thread that pins it first
+  typedef std::function<QImage(int view)> Loader;
+
+  explicit ImageStore(int num_levels = 1);
+  // budget in bytes
+  ImageStore(int num_levels, Loader loader, uint64_t budget);
+  ~ImageStore();
+
+  // Resident view
+  void append(const QImage& image);
+  // View decoded by the loader, of the given size
+  void append(int width, int height);
+  // View decoded by the loader, of the size of the first image it decodes
+  // (zero until then)
+  void append();
+
+  // Decode every view that is not resident, in parallel (num_threads <= 0
+  // uses every hardware thread). Views stay resident as far as the budget
+  // allows.
+  void load_all(int num_threads = 0);
+
+  inline int size() const { return (int)m_Views.size(); }
+  inline int num_levels() const { return m_NumLevels; }
+  inline int width(int view) const { return m_Views[view].width; }
+  inline int height(int view) const { return m_Views[view].height; }
+
+  // Only while the view is pinned if it was appended by size
+  inline const GrayImage& at(int view, int level = 0) const
+  {
+    return (*m_Views[view].levels.load(std::memory_order_acquire))[level];
+  }
+
+  inline bool resident(int view) const
+  {
+    return m_Views[view].levels.load(std::memory_order_acquire) != nullptr;
+  }
+
+  // Load the view if needed and keep it until unpinned, as often as pinned
+  void pin(int view) const;
+  void unpin(int view) const;
+
+  uint64_t resident_bytes() const;
+  int num_loads() const; // decodes so far, for the statistics
+  // Time spent converting decoded views to gray levels, summed over threads
+  double convert_seconds() const;
+
+private:
+  struct View {
+    int width;
+    int height;
+    std::atomic<std::vector<GrayImage>*> levels;
+    bool loading;
+    int pins;
+    uint64_t last_use;
+
+    View(int w, int h) : width(w), height(h), levels(nullptr), loading(false), pins(0), last_use(0) {}
+    View(View&& v)
+    : width(v.width), height(v.height), levels(v.levels.exchange(nullptr))
+    , loading(v.loading), pins(v.pins), last_use(v.last_use) {}
+  };
+
+  std::vector<GrayImage>* convert(const QImage& image) const;
+  static uint64_t bytes(const std::vector<GrayImage>& levels);
+  // m_Mutex locked
+  void evict() const;
+
+  int m_NumLevels;
+  Loader m_Loader;
+  uint64_t m_Budget;
+  mutable std::vector<View> m_Views; // not resized while pinned
+  mutable std::mutex m_Mutex;
+  mutable std::condition_variable m_Loaded;
+  mutable uint64_t m_Clock;
+  mutable uint64_t m_ResidentBytes;
+  mutable int m_NumLoads;
+  mutable std::atomic<int64_t> m_ConvertNsecs;
+};
+
+//
+// Views pinned in a store until destroyed, each once
+//
+class PinnedViews {
+public:
+  explicit PinnedViews(const ImageStore& store) : m_Store(store), m_Views(m_Own) {}
+  // views: empty list the pinned views are kept in, its capacity reused
+  PinnedViews(const ImageStore& store, std::vector<int>& views) : m_Store(store), m_Views(views) {}
+  ~PinnedViews() { clear(); }
+
+  void add(int view)
+  {
+    if (std::find(m_Views.begin(), m_Views.end(), view) != m_Views.end())
+      return;
+    m_Store.pin(view);
+    m_Views.push_back(view);
+  }
+
+  void clear()
+  {
+    for (int v : m_Views)
+      m_Store.unpin(v);
+    m_Views.clear();
+  }
+
+private:
+  PinnedViews(const PinnedViews&);
+  PinnedViews& operator=(const PinnedViews&);
+
+  const ImageStore& m_Store;
+  std::vector<int> m_Own;
+  std::vector<int>& m_Views;
+};
+
+}
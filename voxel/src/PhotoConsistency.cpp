@@ -1,55 +1,155 @@
 #include "VoxelScore1.h"
 #include "PhotoConsistency.h"
+#include "Projection.h"
+#include "morton_code.h"
+#include <QElapsedTimer>
+#include <QImageReader>
 #include <algorithm>
 #include <math.h>
 
 namespace recon {
 
+// Width of a view halved until it is at most max_width (0 = unlimited)
+static int view_width(int width, int max_width)
+{
+  if (max_width > 0) {
+    while (width > max_width && width > 1)
+      width /= 2;
+  }
+  return width;
+}
+
+// Size of PhotoConsistency::load_view from the header of the file,
+// rounded as by QImage::scaledToWidth
+static QSize view_size(const QString& path, int max_width)
+{
+  QSize size = QImageReader(path).size();
+  int w = view_width(size.width(), max_width);
+  if (w != size.width()) {
+    qreal factor = (qreal)w / size.width();
+    size = QSize(w, (int)(factor * size.height() + 0.9999));
+  }
+  return size;
+}
+
+// Serial of the next PhotoConsistency, 0 is never used
+static std::atomic<uint64_t> g_NextSerial(1);
+
 PhotoConsistency::
-PhotoConsistency(const VoxelModel& model, const QList<Camera>& cams)
+PhotoConsistency(const VoxelModel& model, const QList<Camera>& cams, int num_threads)
 : voxel_size((float)model.virtual_box.extent().x() / model.width)
+, voxel_minpos(model.virtual_box.minpos)
 , cameras(cams)
+, images(1, [this](int i) { return load_view(i); }, (uint64_t)std::max(ImageBudget, 0) << 20)
+, m_Serial(g_NextSerial++)
+, m_DecodeNsecs(0)
+, m_ScaleNsecs(0)
+{
+  QElapsedTimer timer;
+  timer.start();
+  if (ImageBudget > 0) {
+    // only the headers are read, views are decoded when they vote
+    for (int i = 0; i < cams.size(); ++i) {
+      QSize size = view_size(cameras[i].imagePath(), MaxImageWidth);
+      images.append(size.width(), size.height());
+    }
+  } else {
+    // Views are converted to gray planes once, the color images are dropped
+    for (int i = 0; i < cams.size(); ++i)
+      images.append();
+    images.load_all(num_threads);
+    printf("loading views: %.2f s\n", timer.elapsed() / 1000.0);
+    print_load_times();
+  }
+  table = CameraTable(cameras, images);
+
+  // Morton codes of the centers on a 1024^3 grid over their bounds
+  int n = table.size();
+  view_order.resize(n);
+  if (n > 0) {
+    AABox bounds(table.centers[0]);
+    for (const Point3& c : table.centers)
+      bounds.add(c);
+    float lo[4], extent[4];
+    ((Vec3)bounds.minpos).store(lo);
+    bounds.extent().store(extent);
+    std::vector<uint64_t> codes(n);
+    for (int i = 0; i < n; ++i) {
+      float c[4];
+      ((Vec3)table.centers[i]).store(c);
+      uint32_t q[3];
+      for (int a = 0; a < 3; ++a)
+        q[a] = (extent[a] > 0.0f ? (uint32_t)((c[a] - lo[a]) / extent[a] * 1023.0f) : 0);
+      codes[i] = morton_encode(q[0], q[1], q[2]);
+      view_order[i] = i;
+    }
+    std::stable_sort(view_order.begin(), view_order.end(),
+                     [&codes](int a, int b) { return codes[a] < codes[b]; });
+  }
+}
+
+QImage PhotoConsistency::load_view(int i) const
 {
-  images.reserve(cams.size());
-  for (int i = 0; i < cams.size(); ++i) {
-    QImage img = QImage(cameras[i].imagePath());
-    //if (img.width() > 640)
-    //  img = img.scaledToWidth(640, Qt::SmoothTransformation);
-    if (img.width() > 960)
-      img = img.scaledToWidth(img.width()/2, Qt::SmoothTransformation);
-    images.append(img);
+  QElapsedTimer timer;
+  timer.start();
+  QImage img = QImage(cameras[i].imagePath());
+  m_DecodeNsecs += timer.nsecsElapsed();
+  //if (img.width() > 640)
+  //  img = img.scaledToWidth(640, Qt::SmoothTransformation);
+  int w = view_width(img.width(), MaxImageWidth);
+  if (w != img.width()) {
+    // one resampling to the last halving
+    timer.start();
+    img = img.scaledToWidth(w, Qt::SmoothTransformation);
+    m_ScaleNsecs += timer.nsecsElapsed();
   }
+  return img;
 }
 
-static double otsu_threshold(const QList<double>& _votes)
+void PhotoConsistency::render_visibility(const VoxelModel& model, const VoxelList& occluders,
+                                         int num_threads)
+{
+  QElapsedTimer timer;
+  timer.start();
+  visibility.render(model, occluders, table, images, num_threads);
+  printf("visibility maps of %d occluders: %.2f s\n", occluders.size(), timer.elapsed() / 1000.0);
+}
+
+void PhotoConsistency::print_load_times() const
+{
+  printf("%d views decoded %d times: decode %.2f s, downscale %.2f s, gray %.2f s (summed over threads)\n",
+         images.size(), images.num_loads(), m_DecodeNsecs.load() * 1e-9,
+         m_ScaleNsecs.load() * 1e-9, images.convert_seconds());
+}
+
+// votes: n votes, sorted in place
+static double otsu_threshold(double* votes, int n)
 {
-  // copy
-  QList<double> votes = _votes;
   // sort votes
-  std::sort(votes.begin(), votes.end());
+  std::sort(votes, votes + n);
   // convert to integral votes
-  for (int i = 0, n = votes.size(); i < n; ++i)
-    votes[i] = votes.at(i) / (double)n;
-  for (int i = 1, n = votes.size(); i < n; ++i)
-    votes[i] = votes.at(i-1) + votes.at(i);
+  for (int i = 0; i < n; ++i)
+    votes[i] = votes[i] / (double)n;
+  for (int i = 1; i < n; ++i)
+    votes[i] = votes[i-1] + votes[i];
   // Otsu Method
   // find argmax{ inter-class variance }
   double answer_t = 0.0;
   double max_var = 0.0;
-  for (int i = 1, n = votes.size(); i < n; ++i) {
+  for (int i = 1; i < n; ++i) {
     // split into { 0 ... i-1 }, { i ... n-1 }
     // compute weights of two classes
     double w1 = (double)i / (double)n;
     double w2 = 1.0 - w1;
     // compute means of two classes
-    double u1 = votes.at(i-1) / w1;
-    double u2 = (votes.at(n-1) - votes.at(i-1)) / w2;
+    double u1 = votes[i-1] / w1;
+    double u2 = (votes[n-1] - votes[i-1]) / w2;
     double ud = u1 - u2;
     // compute inter-class variance
     double sb = w1 * w2 * ud * ud;
     // check if maxima
     if (max_var < sb) {
-      answer_t = (votes.at(i) + votes.at(i-1)) * 0.5;
+      answer_t = (votes[i] + votes[i-1]) * 0.5;
       max_var = sb;
     }
   }
@@ -58,23 +158,252 @@ static double otsu_threshold(const QList<double>& _votes)
 
 double PhotoConsistency::vote(Point3 x) const
 {
-  QList<double> votes;
-  votes.reserve(cameras.size());
-  for (int i = 0, n = cameras.size(); i < n; ++i) {
-    VoxelScore1 score(cameras, images, i, x, voxel_size);
-    votes.append(score.vote());
+  // the candidates of the cache belong to the PhotoConsistency that
+  // filled it, they are dropped when the thread votes for another one
+  static thread_local NeighbourCache cache;
+  static thread_local uint64_t owner = 0;
+  if (owner != m_Serial) {
+    cache.valid = false;
+    owner = m_Serial;
   }
+  return vote(x, cache);
+}
+
+double PhotoConsistency::vote(Point3 x, NeighbourCache& cache) const
+{
+  alignas(16) float point[3] = { (float)x.x(), (float)x.y(), (float)x.z() };
+  double v;
+  vote(point, 1, cache, &v);
+  return v;
+}
+
+void PhotoConsistency::vote(const float* points, int n,
+                            NeighbourCache& cache, double* votes) const
+{
+  std::vector<int>& run_sizes = cache.scratch.run_sizes;
+  run_sizes.assign(n, 1);
+  vote_shared(points, run_sizes.data(), n, cache, votes);
+}
+
+template<typename T>
+static size_t capacity_bytes(const std::vector<T>& v)
+{
+  return v.capacity() * sizeof(T);
+}
+
+template<typename T>
+static size_t capacity_bytes(const std::vector<std::vector<T> >& v)
+{
+  size_t bytes = v.capacity() * sizeof(std::vector<T>);
+  for (const std::vector<T>& u : v)
+    bytes += capacity_bytes(u);
+  return bytes;
+}
+
+size_t NeighbourCache::scratch_bytes() const
+{
+  const Scratch& s = scratch;
+  return capacity_bytes(candidates) + capacity_bytes(s.run_sizes) + capacity_bytes(s.first) +
+    capacity_bytes(s.brick_of) + capacity_bytes(s.order) + capacity_bytes(s.refs) +
+    capacity_bytes(s.margins) + capacity_bytes(s.xs) + capacity_bytes(s.ys) +
+    capacity_bytes(s.depths) + capacity_bytes(s.bricks) + capacity_bytes(s.brick_candidates) +
+    capacity_bytes(s.dirs) + capacity_bytes(s.turns) + capacity_bytes(s.view_votes) +
+    capacity_bytes(s.sorted) + capacity_bytes(s.pinned) + capacity_bytes(s.seen);
+}
+
+//
+// Every temporary lives in cache.scratch, which only grows: voting batches
+// of the same size again does not reallocate it.
+//
+void PhotoConsistency::vote_shared(const float* points, const int* run_sizes, int num_runs,
+                                   NeighbourCache& cache, double* votes) const
+{
+  if (num_runs < 1)
+    return;
+  NeighbourCache::Scratch& s = cache.scratch;
+  const size_t scratch_bytes = cache.scratch_bytes();
+
+  // one evaluation per run, at the centroid of its points
+  std::vector<int>& first = s.first;
+  first.assign(num_runs + 1, 0);
+  for (int r = 0; r < num_runs; ++r)
+    first[r + 1] = first[r] + run_sizes[r];
+  const int n = first[num_runs];
+  std::vector<float>& refs = s.refs;
+  std::vector<float>& margins = s.margins;
+  refs.resize(3 * num_runs);
+  margins.assign(num_runs, 0.0f);
+  for (int r = 0; r < num_runs; ++r) {
+    float* ref = &refs[3 * r];
+    if (run_sizes[r] == 1) {
+      std::copy(points + 3 * first[r], points + 3 * first[r] + 3, ref);
+      continue;
+    }
+    ref[0] = ref[1] = ref[2] = 0.0f;
+    for (int k = first[r]; k < first[r + 1]; ++k) {
+      for (int c = 0; c < 3; ++c)
+        ref[c] += points[3 * k + c] / (float)run_sizes[r];
+    }
+    // in units of the ray steps of VoxelScore1
+    for (int k = first[r]; k < first[r + 1]; ++k) {
+      Vec3 d = Point3(points[3 * k + 0], points[3 * k + 1], points[3 * k + 2]) -
+               Point3(ref[0], ref[1], ref[2]);
+      margins[r] = std::max(margins[r], (float)length(d) / (voxel_size * 0.707f));
+    }
+  }
+
+  // projections of the references into every view, one row per view
+  int num_views = table.size();
+  std::vector<float>& xs = s.xs;
+  std::vector<float>& ys = s.ys;
+  std::vector<float>& depths = s.depths;
+  xs.resize((size_t)num_views * num_runs);
+  ys.resize((size_t)num_views * num_runs);
+  depths.resize((size_t)num_views * num_runs);
+  for (int i = 0; i < num_views; ++i) {
+    project_points(table.txfms[i], refs.data(), num_runs, &xs[(size_t)i * num_runs],
+                   &ys[(size_t)i * num_runs], &depths[(size_t)i * num_runs]);
+  }
+
+  // runs seen by each view, one row per view
+  const bool test_visibility = UseVisibility && !visibility.empty();
+  std::vector<uint8_t>& seen = s.seen;
+  seen.assign((size_t)num_views * num_runs, 1);
+  if (test_visibility) {
+    for (int i = 0; i < num_views; ++i) {
+      for (int r = 0; r < num_runs; ++r) {
+        size_t k = (size_t)i * num_runs + r;
+        seen[k] = visibility.visible(i, xs[k], ys[k], depths[k]);
+      }
+    }
+  }
+
+  // neighbour candidates once per run of references in the same brick,
+  // the brick of the cache first if it is still in use
+  const float brick_size = 8.0f * voxel_size;
+  std::vector<int>& brick_of = s.brick_of;
+  brick_of.resize(num_runs);
+  s.num_bricks = 0;
+  for (int r = 0; r < num_runs; ++r) {
+    Point3 x(refs[3 * r + 0], refs[3 * r + 1], refs[3 * r + 2]);
+    Vec3 p = (x - voxel_minpos) / brick_size;
+    int brick[3] = {
+      (int)floorf((float)p.x()), (int)floorf((float)p.y()), (int)floorf((float)p.z())
+    };
+    const int b = s.num_bricks;
+    if (b == 0 || !std::equal(brick, brick + 3, &s.bricks[3 * (b - 1)])) {
+      if ((int)s.brick_candidates.size() <= b) {
+        s.brick_candidates.resize(b + 1);
+        s.bricks.resize(3 * (b + 1));
+      }
+      if (cache.valid && std::equal(brick, brick + 3, cache.brick)) {
+        s.brick_candidates[b] = cache.candidates;
+      } else {
+        Point3 center = voxel_minpos + Vec3((float)brick[0] + 0.5f,
+                                            (float)brick[1] + 0.5f,
+                                            (float)brick[2] + 0.5f) * brick_size;
+        // half the diagonal, x is on the brick or its faces
+        float radius = 0.8660254f * brick_size;
+        ClosestCameras::find_candidates(table, center, radius, s.brick_candidates[b],
+                                        s.dirs, s.turns);
+      }
+      std::copy(brick, brick + 3, &s.bricks[3 * b]);
+      s.num_bricks++;
+    }
+    brick_of[r] = s.num_bricks - 1;
+  }
+
+  // resident views first, so they are not dropped before they vote
+  std::vector<int>& order = s.order;
+  order.clear();
+  for (int i : view_order) {
+    if (images.resident(i))
+      order.push_back(i);
+  }
+  for (int i : view_order) {
+    if (!images.resident(i))
+      order.push_back(i);
+  }
+
+  std::vector<double>& view_votes = s.view_votes;
+  view_votes.resize((size_t)n * num_views);
+  s.pinned.clear();
+  PinnedViews pinned(images, s.pinned);
+  for (int i : order) {
+    const uint8_t* seen_i = &seen[(size_t)i * num_runs];
+    int num_seen = 0;
+    for (int r = 0; r < num_runs; ++r) {
+      if (!seen_i[r]) {
+        for (int k = first[r]; k < first[r + 1]; ++k)
+          view_votes[(size_t)k * num_views + i] = 0.0;
+      } else {
+        num_seen++;
+      }
+    }
+    cache.num_view_votes += num_runs;
+    cache.num_hidden += num_runs - num_seen;
+    if (num_seen == 0)
+      continue; // not even decoded
+
+    pinned.clear();
+    pinned.add(i);
+    for (int b = 0; b < s.num_bricks; ++b) {
+      for (int j : s.brick_candidates[b][i])
+        pinned.add(j);
+    }
+
+    for (int r = 0; r < num_runs; ++r) {
+      if (!seen_i[r])
+        continue;
+      Point3 x(refs[3 * r + 0], refs[3 * r + 1], refs[3 * r + 2]);
+      Vec3 xy_i(xs[(size_t)i * num_runs + r], ys[(size_t)i * num_runs + r], 0.0f);
+      VoxelScore1 score(table, images, i, x, voxel_size,
+                        &s.brick_candidates[brick_of[r]][i], &xy_i, margins[r]);
+      if (score.sjdk.overflowed())
+        cache.num_peak_overflows++;
+      if (run_sizes[r] == 1) {
+        view_votes[(size_t)first[r] * num_views + i] = score.vote();
+        continue;
+      }
+      // the points voted at their depths along the ray of the reference
+      const float step2 = (float)dot(score.ray.diff, score.ray.diff);
+      for (int k = first[r]; k < first[r + 1]; ++k) {
+        Point3 p(points[3 * k + 0], points[3 * k + 1], points[3 * k + 2]);
+        view_votes[(size_t)k * num_views + i] = score.vote((float)score.ray.projection(p) / step2);
+      }
+    }
+  }
+  pinned.clear();
+
+  // the last brick stays in the cache, its old candidates become scratch
+  const int last = s.num_bricks - 1;
+  std::swap(cache.candidates, s.brick_candidates[last]);
+  std::copy(&s.bricks[3 * last], &s.bricks[3 * last] + 3, cache.brick);
+  cache.valid = true;
+
+  s.sorted.resize(num_views);
+  for (int k = 0; k < n; ++k)
+    votes[k] = combine(&view_votes[(size_t)k * num_views], num_views, s.sorted.data());
+
+  cache.num_batches++;
+  if (cache.scratch_bytes() != scratch_bytes)
+    cache.num_scratch_growths++;
+}
+
+double PhotoConsistency::combine(const double* votes, int n, double* sorted) const
+{
   double threshold = 0.0;
   if (EnableAutoThresholding) {
-    threshold = otsu_threshold(votes);
+    std::copy(votes, votes + n, sorted);
+    threshold = otsu_threshold(sorted, n);
     threshold = fmax(threshold, VotingThreshold);
   } else {
     threshold = VotingThreshold;
   }
 
   double sum = 0.0;
-  for (int i = 0, n = votes.size(); i < n; ++i) {
-    double v = votes.at(i);
+  for (int i = 0; i < n; ++i) {
+    double v = votes[i];
     //sum += v;
     sum += (v >= threshold ? v : 0.0);
     //sum = fmax(sum, v);
@@ -84,5 +413,10 @@ double PhotoConsistency::vote(Point3 x) const
 
 bool PhotoConsistency::EnableAutoThresholding = true;
 double PhotoConsistency::VotingThreshold = 0.0;
+int PhotoConsistency::ImageBudget = 0;
+int PhotoConsistency::MaxImageWidth = 960;
+bool PhotoConsistency::SharedFaceVotes = false;
+bool PhotoConsistency::UseVisibility = false;
+bool PhotoConsistency::DepthMapVotes = false;
 
 }
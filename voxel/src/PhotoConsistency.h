@@ -3,21 +3,127 @@
 #include "Camera.h"
 #include "VoxelModel.h"
 #include "VoxelScore1.h"
+#include "ImageStore.h"
+#include "VisibilityMap.h"
 #include <QList>
-#include <QImage>
+#include <atomic>
+#include <vector>
 
 namespace recon {
 
+//
+// Neighbour candidates of every view (ClosestCameras::find_candidates)
+// for the last brick of 8x8x8 voxels voted in. One per voting thread,
+// edges voted in Morton order mostly stay in the same brick.
+//
+// It also holds the scratch buffers of the batch votes of its thread.
+// They only grow, so once they fit the largest batch they are not
+// reallocated (this says nothing of the images decoded by ImageStore
+// under a budget or of other allocations on the vote path).
+//
+struct NeighbourCache {
+  bool valid;
+  int brick[3];
+  std::vector<std::vector<int> > candidates;
+
+  struct Scratch {
+    std::vector<int> run_sizes, first, brick_of, order;
+    std::vector<float> refs, margins, xs, ys, depths;
+    // candidates of the bricks of a batch, num_bricks of them in use
+    int num_bricks;
+    std::vector<int> bricks; // XYZXYZ...
+    std::vector<std::vector<std::vector<int> > > brick_candidates;
+    std::vector<Vec3> dirs; // of find_candidates
+    std::vector<float> turns;
+    std::vector<double> view_votes, sorted;
+    std::vector<int> pinned;
+    std::vector<uint8_t> seen;
+  } scratch;
+
+  // Bytes reserved by candidates and scratch, changes when they grow
+  size_t scratch_bytes() const;
+
+  // Votes of a point (or run of points) in a view, and those skipped
+  // because the view does not see it (PhotoConsistency::UseVisibility)
+  uint64_t num_view_votes;
+  uint64_t num_hidden;
+
+  // Batches voted with this cache, those that grew its scratch buffers
+  // and peaks lists of VoxelScore1 that went beyond PeakList::CAPACITY:
+  // in steady state the last two stay put
+  uint64_t num_batches;
+  uint64_t num_scratch_growths;
+  uint64_t num_peak_overflows;
+
+  NeighbourCache()
+  : valid(false), num_view_votes(0), num_hidden(0)
+  , num_batches(0), num_scratch_growths(0), num_peak_overflows(0) {}
+};
+
 struct PhotoConsistency {
   float voxel_size;
+  Point3 voxel_minpos;
   QList<Camera> cameras;
-  QList<QImage> images;
+  ImageStore images;
+  CameraTable table;
+  // Views in Morton order of their centers, neighbours mostly close by
+  std::vector<int> view_order;
+  // Views that do not see a point vote 0 on it, if rendered
+  VisibilityMaps visibility;
 
-  PhotoConsistency(const VoxelModel& model, const QList<Camera>& cams);
+  // Views are decoded on num_threads threads (<= 0: every hardware thread)
+  PhotoConsistency(const VoxelModel& model, const QList<Camera>& cams,
+                   int num_threads = 0);
+  // Without a cache, each thread reuses one of its own
   double vote(Point3 x) const;
+  double vote(Point3 x, NeighbourCache& cache) const;
+  // Votes of n points (XYZXYZ..., aligned to 16 bytes), view by view: the
+  // views already resident first, then the others in view_order, each
+  // pinned with its neighbours while it votes on every point
+  void vote(const float* points, int n, NeighbourCache& cache, double* votes) const;
+  // Same for runs of points close together (the faces of a voxel): run r
+  // is made of run_sizes[r] consecutive points, evaluated once per view at
+  // their centroid and voted at their depths along its rays
+  // (VoxelScore1::vote(d)). Runs of one point vote as above.
+  void vote_shared(const float* points, const int* run_sizes, int num_runs,
+                   NeighbourCache& cache, double* votes) const;
 
   static bool EnableAutoThresholding;
   static double VotingThreshold;
+  // Megabytes of gray planes kept resident, 0 decodes every view up front
+  static int ImageBudget;
+  // Views wider than this are halved until they fit, 0 keeps them all at
+  // full size
+  static int MaxImageWidth;
+
+  // Faces of a voxel share one evaluation per view in build_graph
+  static bool SharedFaceVotes;
+
+  // Render the depth maps of visibility from occluders of model, used by
+  // the votes with UseVisibility
+  void render_visibility(const VoxelModel& model, const VoxelList& occluders,
+                         int num_threads = 0);
+  // Views are voted on only where the visibility maps see the point
+  static bool UseVisibility;
+  // build_graph weights the edges from the depth maps of every view
+  // (DepthMap) instead of voting them one by one
+  static bool DepthMapVotes;
+  // The visibility maps are needed by either of them
+  static inline bool needs_visibility() { return UseVisibility || DepthMapVotes; }
+
+  // Time spent in each stage of loading the views so far
+  void print_load_times() const;
+
+private:
+  // Decoded and downscaled view i
+  QImage load_view(int i) const;
+
+  // Vote of a point from its votes in n views, sorted: scratch of n
+  double combine(const double* votes, int n, double* sorted) const;
+
+  uint64_t m_Serial; // tells the thread caches of vote(Point3) apart
+  mutable std::atomic<int64_t> m_DecodeNsecs; // summed over threads
+  mutable std::atomic<int64_t> m_ScaleNsecs;
 };
 
 }
@@ -0,0 +1,74 @@
+#include "Projection.h"
+#include <immintrin.h>
+
+namespace recon {
+
+using vectormath::soa::floatvec;
+using vectormath::soa::FLOATVEC_SIZE;
+
+#if defined(__AVX__)
+static inline floatvec splat(float a) { return _mm256_set1_ps(a); }
+static inline floatvec add(floatvec a, floatvec b) { return _mm256_add_ps(a, b); }
+static inline floatvec mul(floatvec a, floatvec b) { return _mm256_mul_ps(a, b); }
+static inline floatvec div(floatvec a, floatvec b) { return _mm256_div_ps(a, b); }
+static inline void storeu(float* p, floatvec a) { _mm256_storeu_ps(p, a); }
+#else
+static inline floatvec splat(float a) { return _mm_set1_ps(a); }
+static inline floatvec add(floatvec a, floatvec b) { return _mm_add_ps(a, b); }
+static inline floatvec mul(floatvec a, floatvec b) { return _mm_mul_ps(a, b); }
+static inline floatvec div(floatvec a, floatvec b) { return _mm_div_ps(a, b); }
+static inline void storeu(float* p, floatvec a) { _mm_storeu_ps(p, a); }
+#endif
+
+// Row r of txfm * (p, 1), summed in the order of Mat4 * Vec4
+static inline floatvec transform_row(const float* m, int r, const vectormath::soa::Vec3& p)
+{
+  floatvec v = mul(splat(m[r]), p.x);
+  v = add(mul(splat(m[4 + r]), p.y), v);
+  v = add(mul(splat(m[8 + r]), p.z), v);
+  return add(splat(m[12 + r]), v);
+}
+
+void project_points(const Mat4& txfm, const float* points, int n,
+                    float* x, float* y, float* depth)
+{
+  float m[16]; // column major
+  txfm.store(m);
+
+  const int N = FLOATVEC_SIZE;
+  for (int i = 0; i < n; i += N) {
+    vectormath::soa::Vec3 p;
+    alignas(32) float tail[3 * N];
+    if (i + N <= n) {
+      vectormath::soa::load(p, points + 3 * i);
+    } else {
+      // pad the last points with copies of the first one of them
+      for (int k = 0; k < N; ++k)
+        for (int c = 0; c < 3; ++c)
+          tail[3 * k + c] = points[3 * (i + (i + k < n ? k : 0)) + c];
+      vectormath::soa::load(p, tail);
+    }
+
+    floatvec w = transform_row(m, 3, p);
+    floatvec px = div(transform_row(m, 0, p), w);
+    floatvec py = div(transform_row(m, 1, p), w);
+
+    if (i + N <= n) {
+      storeu(x + i, px);
+      storeu(y + i, py);
+      storeu(depth + i, w);
+    } else {
+      alignas(32) float out[3][N];
+      storeu(out[0], px);
+      storeu(out[1], py);
+      storeu(out[2], w);
+      for (int k = 0; i + k < n; ++k) {
+        x[i + k] = out[0][k];
+        y[i + k] = out[1][k];
+        depth[i + k] = out[2][k];
+      }
+    }
+  }
+}
+
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <vectormath.h>
+
+namespace recon {
+
+using vectormath::aos::Mat4;
+
+//
+// Project n points into one view, a vector of points per step
+//
+// The points are loaded into vectormath::soa::Vec3 (XXXXYYYYZZZZ with
+// SSE) and transformed as Vec3::proj(txfm * Vec4(p, 1)), with the same
+// operations as the scalar path so the results are identical.
+//
+// points: XYZXYZ..., aligned to 16 bytes
+// x, y:   image coordinates
+// depth:  w before the division, the distance along the view axis
+//
+void project_points(const Mat4& txfm, const float* points, int n,
+                    float* x, float* y, float* depth);
+
+}
@@ -0,0 +1,198 @@
+#include "Pyramid.h"
+#include "BuildGraph.h"
+#include "GraphAccess.h"
+#include "GraphCut.h"
+#include "PhotoConsistency.h"
+#include "VisualHull.h"
+#include "morton_code.h"
+
+#include <QElapsedTimer>
+#include <algorithm>
+#include <vector>
+
+namespace recon {
+
+static uint64_t bitset_words(uint64_t length)
+{
+  return std::max<uint64_t>(1, length >> 6);
+}
+
+//
+// Voxels on either side of a label change (or inside at the border of the
+// grid), found among scan and their 6-neighbours. Every label change must
+// involve a voxel of scan. With inner_only only the inside voxels are
+// kept, which is the surface. The result is sorted.
+//
+static VoxelList label_boundary(const VoxelModel& model,
+                                const std::vector<uint64_t>& inside,
+                                const VoxelList& scan, bool inner_only)
+{
+  const uint32_t size[3] = { model.width, model.height, model.depth };
+  std::vector<uint64_t> result;
+
+  for (uint64_t m : scan) {
+    uint32_t p[3];
+    morton_decode(m, p[0], p[1], p[2]);
+    const bool a = test_bit(inside, m);
+
+    for (int axis = 0; axis < 3; ++axis) {
+      for (int dir = -1; dir <= 1; dir += 2) {
+        if ((dir < 0 && p[axis] == 0) || (dir > 0 && p[axis] + 1 == size[axis])) {
+          if (a)
+            result.push_back(m);
+          continue;
+        }
+        uint32_t q[3] = { p[0], p[1], p[2] };
+        q[axis] += dir;
+        const uint64_t n = morton_encode(q[0], q[1], q[2]);
+        const bool b = test_bit(inside, n);
+        if (a == b)
+          continue;
+        if (a || !inner_only)
+          result.push_back(m);
+        if (b || !inner_only)
+          result.push_back(n);
+      }
+    }
+  }
+
+  std::sort(result.begin(), result.end());
+  result.erase(std::unique(result.begin(), result.end()), result.end());
+
+  VoxelList list;
+  list.reserve((int)result.size());
+  for (uint64_t m : result)
+    list.append(m);
+  return list;
+}
+
+// Voxels within radius (Chebyshev distance) of the given ones, sorted
+static VoxelList dilate(const VoxelModel& model, const VoxelList& voxels, int radius)
+{
+  const int size[3] = { (int)model.width, (int)model.height, (int)model.depth };
+  std::vector<uint64_t> marked(bitset_words(model.morton_length), 0);
+  std::vector<uint64_t> result;
+
+  for (uint64_t m : voxels) {
+    uint32_t p[3];
+    morton_decode(m, p[0], p[1], p[2]);
+    int lo[3], hi[3];
+    for (int axis = 0; axis < 3; ++axis) {
+      lo[axis] = std::max(0, (int)p[axis] - radius);
+      hi[axis] = std::min(size[axis] - 1, (int)p[axis] + radius);
+    }
+    for (int z = lo[2]; z <= hi[2]; ++z) {
+      for (int y = lo[1]; y <= hi[1]; ++y) {
+        for (int x = lo[0]; x <= hi[0]; ++x) {
+          uint64_t n = morton_encode(x, y, z);
+          if (!test_bit(marked, n)) {
+            assign_bit(marked, n, true);
+            result.push_back(n);
+          }
+        }
+      }
+    }
+  }
+
+  std::sort(result.begin(), result.end());
+  VoxelList list;
+  list.reserve((int)result.size());
+  for (uint64_t m : result)
+    list.append(m);
+  return list;
+}
+
+//
+// Labels of the next level: every voxel inherits the label of its parent
+// (the 8 children of voxel m are 8m .. 8m+7, so one parent bit spreads to
+// one child byte)
+//
+static std::vector<uint64_t> refine_labels(const std::vector<uint64_t>& inside,
+                                           uint64_t fine_length)
+{
+  std::vector<uint64_t> fine(bitset_words(fine_length), 0);
+  for (uint64_t j = 0; j < fine.size(); ++j) {
+    uint64_t parents = (inside[j >> 3] >> ((j & 7) * 8)) & 0xFF;
+    uint64_t word = 0;
+    for (int b = 0; b < 8; ++b) {
+      if ((parents >> b) & 0x1)
+        word |= (0xFFull << (b * 8));
+    }
+    fine[j] = word;
+  }
+  return fine;
+}
+
+VoxelList reconstruct_pyramid(const VoxelModel& model,
+                              const QList<Camera>& cameras,
+                              double lambda, double mju,
+                              const PyramidOptions& options)
+{
+  const int first = std::max(1, (int)model.level - std::max(0, options.levels));
+  std::vector<uint64_t> inside;
+  VoxelList band; // voxels of the current level that are not fixed
+
+  QElapsedTimer timer;
+  for (int level = first; level <= model.level; ++level) {
+    timer.start();
+    VoxelModel lmodel(level, model.real_box);
+    printf("== level %d\n", level);
+
+    VoxelList hull;
+    if (level == first) {
+      // whole visual hull, nothing is inside yet
+      inside.assign(bitset_words(lmodel.morton_length), 0);
+      printf("processing shape prior (visual hull)...\n");
+      hull = visual_hull(lmodel, cameras, options.num_threads);
+      band = hull;
+    } else {
+      // children of the coarse band, the rest keeps its parent's label
+      VoxelList children;
+      children.reserve(band.size() * 8);
+      for (uint64_t m : band) {
+        for (uint64_t k = 0; k < 8; ++k)
+          children.append((m << 3) | k);
+      }
+      band = children;
+      inside = refine_labels(inside, lmodel.morton_length);
+
+      printf("processing shape prior (visual hull) of %d band voxels...\n", band.size());
+      hull = visual_hull(lmodel, cameras, band, options.num_threads);
+
+      // band voxels outside the hull are fixed outside
+      int h = 0;
+      for (uint64_t m : band) {
+        if (h < hull.size() && hull[h] == m)
+          ++h;
+        else
+          assign_bit(inside, m, false);
+      }
+    }
+
+    SparseVoxelGraph graph;
+    if (level > first && PhotoConsistency::needs_visibility()) {
+      // visibility past the surface of the coarser cut rather than past
+      // the hull
+      VoxelList surface = label_boundary(lmodel, inside, band, true);
+      build_graph(graph, lmodel, cameras, hull, surface, options.num_threads);
+    } else {
+      build_graph(graph, lmodel, cameras, hull, options.num_threads);
+    }
+    hull = VoxelList();
+    // the first level has no labels to fix the seams of tiles with
+    uint32_t tile_size = (level == first ? lmodel.width : (uint32_t)options.tile_size);
+    graph_cut_band(graph, inside, lambda, mju, tile_size, options.cut);
+    printf("level %d: %.3f s\n", level, timer.elapsed() / 1000.0);
+
+    if (level == model.level)
+      break;
+
+    VoxelList boundary = label_boundary(lmodel, inside, band, false);
+    band = dilate(lmodel, boundary, options.band);
+    printf("band: %d boundary voxels, %d after dilation\n", boundary.size(), band.size());
+  }
+
+  return label_boundary(model, inside, band, true);
+}
+
+}
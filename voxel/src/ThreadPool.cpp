@@ -0,0 +1,105 @@
+#include "ThreadPool.h"
+#include <algorithm>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace recon {
+
+namespace {
+
+struct WorkQueue {
+  std::mutex mutex;
+  std::deque<uint64_t> blocks;
+
+  // owner takes blocks in ascending order
+  bool pop_front(uint64_t& block)
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (blocks.empty())
+      return false;
+    block = blocks.front();
+    blocks.pop_front();
+    return true;
+  }
+
+  // thieves take the blocks the owner would reach last
+  bool steal_back(uint64_t& block)
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (blocks.empty())
+      return false;
+    block = blocks.back();
+    blocks.pop_back();
+    return true;
+  }
+};
+
+}
+
+ThreadPool::ThreadPool(int num_threads)
+: m_NumThreads(num_threads > 0 ? num_threads : default_size())
+{
+}
+
+int ThreadPool::size() const
+{
+  return m_NumThreads;
+}
+
+int ThreadPool::default_size()
+{
+  int n = (int)std::thread::hardware_concurrency();
+  return (n > 0 ? n : 1);
+}
+
+void ThreadPool::run(uint64_t num_blocks, const std::function<void(uint64_t, int)>& func)
+{
+  if (num_blocks == 0)
+    return;
+
+  int nthreads = (int)std::min<uint64_t>(m_NumThreads, num_blocks);
+  if (nthreads <= 1) {
+    for (uint64_t b = 0; b < num_blocks; ++b)
+      func(b, 0);
+    return;
+  }
+
+  // Distribute contiguous runs of blocks
+  std::vector<WorkQueue> queues(nthreads);
+  for (int t = 0; t < nthreads; ++t) {
+    uint64_t b0 = num_blocks * t / nthreads;
+    uint64_t b1 = num_blocks * (t+1) / nthreads;
+    for (uint64_t b = b0; b < b1; ++b)
+      queues[t].blocks.push_back(b);
+  }
+
+  auto worker = [&queues,&func,nthreads](int tid) {
+    uint64_t block;
+    for (;;) {
+      if (queues[tid].pop_front(block)) {
+        func(block, tid);
+        continue;
+      }
+      // Local run is drained: try to steal from the others
+      bool stolen = false;
+      for (int k = 1; k < nthreads && !stolen; ++k) {
+        stolen = queues[(tid + k) % nthreads].steal_back(block);
+      }
+      if (!stolen)
+        break;
+      func(block, tid);
+    }
+  };
+
+  std::vector<std::thread> threads;
+  threads.reserve(nthreads - 1);
+  for (int t = 1; t < nthreads; ++t)
+    threads.emplace_back(worker, t);
+  worker(0);
+  for (std::thread& th : threads)
+    th.join();
+}
+
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <stdint.h>
+#include <functional>
+
+namespace recon {
+
+//
+// Work-stealing scheduler for block-parallel loops
+//
+// [0, num_blocks) is cut into one contiguous run per thread, so every
+// thread starts on its own Morton-contiguous part of the grid. A thread
+// that drains its run steals blocks from the tail of another thread's run.
+//
+class ThreadPool {
+public:
+  // num_threads <= 0 selects the number of hardware threads
+  explicit ThreadPool(int num_threads = 0);
+
+  int size() const;
+
+  // F: void func(uint64_t block, int thread_id)
+  void run(uint64_t num_blocks, const std::function<void(uint64_t, int)>& func);
+
+  // F: void func(uint64_t begin, uint64_t end, int thread_id)
+  template<typename F>
+  void parallel_for(uint64_t begin, uint64_t end, uint64_t block_size, F func)
+  {
+    if (begin >= end)
+      return;
+    if (block_size < 1)
+      block_size = 1;
+
+    uint64_t num_blocks = (end - begin + block_size - 1) / block_size;
+    run(num_blocks, [begin,end,block_size,&func](uint64_t block, int tid) {
+      uint64_t b0 = begin + block * block_size;
+      uint64_t b1 = (end - b0 > block_size ? b0 + block_size : end);
+      func(b0, b1, tid);
+    });
+  }
+
+  static int default_size();
+
+private:
+  int m_NumThreads;
+};
+
+}
@@ -0,0 +1,96 @@
+#include "VisibilityMap.h"
+#include "Projection.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <float.h>
+#include <math.h>
+
+namespace recon {
+
+// Occluders projected together
+static const int BATCH_SIZE = 512;
+
+void VisibilityMaps::render(const VoxelModel& model, const VoxelList& occluders,
+                            const CameraTable& table, const ImageStore& images,
+                            int num_threads)
+{
+  const float voxel_h = (float)model.virtual_box.extent().x() / model.width;
+  m_Margin = MARGIN * voxel_h;
+
+  // centers of the occluders, XYZXYZ...
+  const int n = occluders.size();
+  std::vector<float> centers(3 * (size_t)n);
+  for (int k = 0; k < n; ++k) {
+    float c[4];
+    ((Vec3)model.element_box(occluders[k]).center()).store(c);
+    std::copy(c, c + 3, &centers[3 * (size_t)k]);
+  }
+
+  m_Maps.assign(table.size(), Map());
+  ThreadPool pool(num_threads);
+  pool.run(table.size(), [&](uint64_t view, int) {
+    Map& map = m_Maps[view];
+    map.width = images.width((int)view);
+    map.height = images.height((int)view);
+    map.cols = (map.width + CELL_SIZE - 1) / CELL_SIZE;
+    map.rows = (map.height + CELL_SIZE - 1) / CELL_SIZE;
+    map.depths.assign((size_t)map.cols * map.rows, FLT_MAX);
+
+    // x, y and w rows of the transform, without translation
+    float m[16], rows[3][3]; // column major
+    table.txfms[view].store(m);
+    for (int r = 0; r < 3; ++r) {
+      for (int c = 0; c < 3; ++c)
+        rows[r][c] = m[4 * c + (r < 2 ? r : 3)];
+    }
+    const float wnorm = sqrtf(rows[2][0] * rows[2][0] + rows[2][1] * rows[2][1] +
+                              rows[2][2] * rows[2][2]);
+    const float inner = 0.5f * voxel_h; // radius of the inscribed sphere
+
+    float xs[BATCH_SIZE], ys[BATCH_SIZE], ws[BATCH_SIZE];
+    for (int k0 = 0; k0 < n; k0 += BATCH_SIZE) {
+      const int count = std::min(BATCH_SIZE, n - k0);
+      project_points(table.txfms[view], &centers[3 * (size_t)k0], count, xs, ys, ws);
+      for (int k = 0; k < count; ++k) {
+        const float x = xs[k], y = ys[k], w = ws[k];
+        if (!(w > 0.0f && x >= 0.0f && y >= 0.0f && x < map.width && y < map.height))
+          continue;
+
+        // smallest singular value of the Jacobian of the projection (see
+        // Silhouette::test_sphere): the sphere covers at least that disc
+        float p[3], q[3];
+        for (int c = 0; c < 3; ++c) {
+          p[c] = rows[0][c] - x * rows[2][c];
+          q[c] = rows[1][c] - y * rows[2][c];
+        }
+        float pp = p[0] * p[0] + p[1] * p[1] + p[2] * p[2];
+        float qq = q[0] * q[0] + q[1] * q[1] + q[2] * q[2];
+        float pq = p[0] * q[0] + p[1] * q[1] + p[2] * q[2];
+        float half = 0.5f * (pp - qq);
+        float lmin = std::max(0.5f * (pp + qq) - sqrtf(half * half + pq * pq), 0.0f);
+        float r = sqrtf(lmin) * inner / (w + wnorm * inner);
+
+        // cells whose centers are in the disc, and the cell of the center
+        const float s = 1.0f / CELL_SIZE;
+        int cx0 = std::max((int)ceilf((x - r) * s - 0.5f), 0);
+        int cx1 = std::min((int)floorf((x + r) * s - 0.5f), map.cols - 1);
+        int cy0 = std::max((int)ceilf((y - r) * s - 0.5f), 0);
+        int cy1 = std::min((int)floorf((y + r) * s - 0.5f), map.rows - 1);
+        for (int cy = cy0; cy <= cy1; ++cy) {
+          float dy = (cy + 0.5f) * CELL_SIZE - y;
+          for (int cx = cx0; cx <= cx1; ++cx) {
+            float dx = (cx + 0.5f) * CELL_SIZE - x;
+            if (dx * dx + dy * dy > r * r)
+              continue;
+            float& d = map.depths[(size_t)cy * map.cols + cx];
+            d = std::min(d, w);
+          }
+        }
+        float& d = map.depths[(size_t)((int)y / CELL_SIZE) * map.cols + (int)x / CELL_SIZE];
+        d = std::min(d, w);
+      }
+    }
+  });
+}
+
+}
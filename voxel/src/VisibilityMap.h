@@ -0,0 +1,70 @@
+#pragma once
+
+#include "VoxelModel.h"
+#include "VoxelScore1.h"
+#include <float.h>
+#include <vector>
+
+namespace recon {
+
+//
+// Depth maps of a set of occluding voxels, one per view
+//
+// Every voxel is splatted with the depth of its center into the cells of
+// CELL_SIZE pixels whose centers its inscribed sphere projects onto, and
+// into the cell of its own center. A point is seen by a view if it projects
+// into the image, in front of the view, and is at most MARGIN voxels
+// behind the map there. Cells no voxel reaches see everything.
+//
+// Occluders are typically the surface of the visual hull or of a coarser
+// cut, so the test is approximate: parts of the object hidden only by the
+// hull (concavities) are taken as occluded.
+//
+class VisibilityMaps {
+public:
+  static const int CELL_SIZE = 4; // pixels
+  static constexpr float MARGIN = 3.0f; // voxels
+
+  VisibilityMaps() : m_Margin(0.0f) {}
+
+  // Views of the sizes in images and transforms in table, voxels of model
+  // (num_threads <= 0 uses every hardware thread)
+  void render(const VoxelModel& model, const VoxelList& occluders,
+              const CameraTable& table, const ImageStore& images,
+              int num_threads = 0);
+
+  inline bool empty() const { return m_Maps.empty(); }
+
+  // x, y, depth: a point projected into view i (project_points)
+  inline bool visible(int i, float x, float y, float depth) const
+  {
+    const Map& map = m_Maps[i];
+    if (!(depth > 0.0f && x >= 0.0f && y >= 0.0f && x < map.width && y < map.height))
+      return false;
+    int cx = (int)x / CELL_SIZE, cy = (int)y / CELL_SIZE;
+    return depth <= map.depths[(size_t)cy * map.cols + cx] + m_Margin;
+  }
+
+  // Depth of the map at (x, y) in view i, FLT_MAX outside the image or
+  // where no occluder projects
+  inline float depth(int i, float x, float y) const
+  {
+    const Map& map = m_Maps[i];
+    if (!(x >= 0.0f && y >= 0.0f && x < map.width && y < map.height))
+      return FLT_MAX;
+    int cx = (int)x / CELL_SIZE, cy = (int)y / CELL_SIZE;
+    return map.depths[(size_t)cy * map.cols + cx];
+  }
+
+private:
+  struct Map {
+    int width, height; // pixels
+    int cols, rows;    // cells
+    std::vector<float> depths; // nearest center per cell, FLT_MAX if none
+  };
+
+  std::vector<Map> m_Maps;
+  float m_Margin; // MARGIN voxels
+};
+
+}
@@ -1,48 +1,435 @@
 #include "VisualHull.h"
+#include "Projection.h"
+#include "ThreadPool.h"
 #include <QImage>
+#include <algorithm>
+#include <float.h>
+#include <math.h>
+#include <stdint.h>
+#include <vector>
 
 namespace recon {
 
-VoxelList visual_hull(const VoxelModel& model, const QList<Camera>& cameras)
+namespace {
+
+// Squared distances of a padded grid to its nearest target pixel, exact
+// Euclidean (Felzenszwalb and Huttenlocher), FLT_MAX without any target
+void squared_distances(const std::vector<uint8_t>& target, int width, int height,
+                       std::vector<float>& dist)
+{
+  const int n = std::max(width, height);
+  std::vector<float> f(n), d(n), z(n + 1);
+  std::vector<int> v(n);
+
+  // lower envelope of the parabolas of the sites with finite f
+  auto transform = [&](int length) {
+    int k = -1;
+    for (int q = 0; q < length; ++q) {
+      if (f[q] == FLT_MAX)
+        continue;
+      float s = -FLT_MAX;
+      while (k >= 0) {
+        s = ((f[q] + (float)q * q) - (f[v[k]] + (float)v[k] * v[k])) / (2.0f * (q - v[k]));
+        if (s > z[k])
+          break;
+        --k;
+      }
+      ++k;
+      v[k] = q, z[k] = (k == 0 ? -FLT_MAX : s), z[k + 1] = FLT_MAX;
+    }
+    for (int q = 0, j = 0; q < length; ++q) {
+      if (k < 0) {
+        d[q] = FLT_MAX;
+        continue;
+      }
+      while (z[j + 1] < q)
+        ++j;
+      d[q] = (float)(q - v[j]) * (q - v[j]) + f[v[j]];
+    }
+  };
+
+  // along the rows, the distance to the nearest target on either side
+  dist.resize((size_t)width * height);
+  for (int y = 0; y < height; ++y) {
+    const uint8_t* t = &target[(size_t)y * width];
+    float* row = &dist[(size_t)y * width];
+    int last = -1;
+    for (int x = 0; x < width; ++x) {
+      if (t[x])
+        last = x;
+      row[x] = (last >= 0 ? (float)(x - last) : FLT_MAX);
+    }
+    last = -1;
+    for (int x = width - 1; x >= 0; --x) {
+      if (t[x])
+        last = x;
+      if (last >= 0)
+        row[x] = std::min(row[x], (float)(last - x));
+      row[x] = (row[x] == FLT_MAX ? FLT_MAX : row[x] * row[x]);
+    }
+  }
+  for (int x = 0; x < width; ++x) {
+    for (int y = 0; y < height; ++y)
+      f[y] = dist[(size_t)y * width + x];
+    transform(height);
+    for (int y = 0; y < height; ++y)
+      dist[(size_t)y * width + x] = d[y];
+  }
+}
+
+//
+// Signed distance transform of a silhouette, set where qGray > 100
+//
+// Pixel (x, y) covers [x, x + 1) x [y, y + 1). Inside the silhouette the
+// map holds the distance between pixel centers to the nearest pixel outside
+// of it (the image border counts as outside), elsewhere minus the distance
+// to the nearest pixel inside of it. Distances are stored in quarter
+// pixels, rounded down so the bounds stay conservative, 2 bytes per pixel.
+//
+struct DistanceMap {
+  int width = 0;
+  int height = 0;
+  std::vector<int16_t> sdt; // quarter pixels
+
+  DistanceMap() {}
+
+  explicit DistanceMap(const QImage& mask)
+  : width(mask.width()), height(mask.height())
+  {
+    // one pixel border outside the silhouette
+    const int pw = width + 2, ph = height + 2;
+    std::vector<uint8_t> inside((size_t)pw * ph, 0);
+    QImage argb = mask.convertToFormat(QImage::Format_ARGB32);
+    for (int y = 0; y < height; ++y) {
+      const QRgb* src = (const QRgb*)argb.constScanLine(y);
+      uint8_t* row = &inside[(size_t)(y + 1) * pw + 1];
+      for (int x = 0; x < width; ++x)
+        row[x] = (qGray(src[x]) > 100);
+    }
+
+    std::vector<uint8_t> outside(inside.size());
+    for (size_t i = 0; i < inside.size(); ++i)
+      outside[i] = !inside[i];
+    std::vector<float> to_outside, to_inside;
+    squared_distances(outside, pw, ph, to_outside);
+    squared_distances(inside, pw, ph, to_inside);
+
+    sdt.resize((size_t)width * height);
+    for (int y = 0; y < height; ++y) {
+      for (int x = 0; x < width; ++x) {
+        size_t i = (size_t)(y + 1) * pw + x + 1;
+        float d = std::min(4.0f * sqrtf(inside[i] ? to_outside[i] : to_inside[i]), (float)INT16_MAX);
+        sdt[(size_t)y * width + x] = (int16_t)(inside[i] ? (int)d : -(int)d);
+      }
+    }
+  }
+
+  // Signed lower bound of the distance from (fx, fy) to the silhouette
+  // boundary: a disc of radius r around the point is inside the silhouette
+  // if the bound is >= r, and outside of it if the bound is <= -r
+  inline float bound(float fx, float fy) const
+  {
+    // nearest point of the image [0, width] x [0, height], the pixel
+    // containing it and the distance to the center of that pixel
+    float cx = std::min(std::max(fx, 0.0f), (float)width);
+    float cy = std::min(std::max(fy, 0.0f), (float)height);
+    int x = std::min((int)cx, width - 1), y = std::min((int)cy, height - 1);
+    float ex = fx - (x + 0.5f), ey = fy - (y + 0.5f);
+    // a pixel center is at most sqrt(1/2) from the edges of its pixel
+    float e = sqrtf(ex * ex + ey * ey) + 0.70710678f;
+
+    float d = 0.25f * sdt[(size_t)y * width + x];
+    if (d > 0.0f)
+      return std::max(d - e, 0.0f);
+    // the silhouette lies in the image
+    float rx = fx - cx, ry = fy - cy;
+    return -std::max(-d - e, sqrtf(rx * rx + ry * ry));
+  }
+};
+
+enum class BoxTest {
+  Outside, // no point of the sphere projects onto the silhouette
+  Inside,  // every point of it does
+  Partial
+};
+
+struct Silhouette {
+  Mat4 transform;
+  float rows[3][3]; // x, y and w rows of the transform, without translation
+  float wnorm;      // length of the w row
+  DistanceMap distance;
+
+  Silhouette() {}
+
+  Silhouette(const Camera& cam, const QImage& mask)
+  : transform(cam.intrinsicForImage(mask.width(), mask.height()) * cam.extrinsic())
+  , distance(mask)
+  {
+    float m[16]; // column major
+    transform.store(m);
+    for (int r = 0; r < 3; ++r) {
+      for (int c = 0; c < 3; ++c)
+        rows[r][c] = m[4 * c + (r < 2 ? r : 3)];
+    }
+    wnorm = sqrtf(rows[2][0] * rows[2][0] + rows[2][1] * rows[2][1] + rows[2][2] * rows[2][2]);
+  }
+
+  //
+  // Sphere of the given radius around a point projected to (x, y) at depth w
+  //
+  // Offsetting the center by u moves its projection by
+  // (J u) / (w + wrow . u), J the 2x3 matrix of the rows x - x * w and
+  // y - y * w. The footprint of the sphere is within the largest singular
+  // value of J times radius / (w - |wrow| radius) of (x, y).
+  //
+  inline BoxTest test_sphere(float x, float y, float w, float radius) const
+  {
+    float den = w - wnorm * radius;
+    if (!(den > 0.0f))
+      return BoxTest::Partial; // not in front of the camera
+    float b = distance.bound(x, y);
+    if (b == 0.0f)
+      return BoxTest::Partial; // close to the boundary
+    float p[3], q[3];
+    for (int c = 0; c < 3; ++c) {
+      p[c] = rows[0][c] - x * rows[2][c];
+      q[c] = rows[1][c] - y * rows[2][c];
+    }
+    float pp = p[0] * p[0] + p[1] * p[1] + p[2] * p[2];
+    float qq = q[0] * q[0] + q[1] * q[1] + q[2] * q[2];
+    float pq = p[0] * q[0] + p[1] * q[1] + p[2] * q[2];
+    float half = 0.5f * (pp - qq);
+    float lmax = 0.5f * (pp + qq) + sqrtf(half * half + pq * pq);
+    float r = sqrtf(lmax) * radius / den;
+    if (b <= -r)
+      return BoxTest::Outside;
+    if (b >= r)
+      return BoxTest::Inside;
+    return BoxTest::Partial;
+  }
+};
+
+std::vector<Silhouette> load_silhouettes(const QList<Camera>& cameras, ThreadPool& pool)
+{
+  std::vector<Silhouette> silhouettes(cameras.size());
+  pool.run(cameras.size(), [&](uint64_t i, int) {
+    const Camera& cam = cameras[(int)i];
+    silhouettes[i] = Silhouette(cam, QImage(cam.maskPath()));
+  });
+  return silhouettes;
+}
+
+//
+// Voxel centers from per-axis tables, the same values as
+// model.element_box(m).center() without decoding and lerping every voxel
+//
+struct VoxelCenters {
+  std::vector<float> axis[3];
+  float radius; // of the spheres around the voxels
+
+  explicit VoxelCenters(const VoxelModel& model)
+  {
+    for (int c = 0; c < 3; ++c)
+      axis[c].resize(model.width);
+    for (uint32_t i = 0; i < model.width; ++i) {
+      float pos[4];
+      ((Vec3)model.element_box(morton_encode(i, i, i)).center()).store(pos);
+      for (int c = 0; c < 3; ++c)
+        axis[c][i] = pos[c];
+    }
+    float size[4];
+    model.real_box.extent().store(size);
+    radius = 0.5f * sqrtf(size[0] * size[0] + size[1] * size[1] + size[2] * size[2]) / model.width;
+  }
+
+  inline void get(uint32_t x, uint32_t y, uint32_t z, float* xyz) const
+  {
+    xyz[0] = axis[0][x], xyz[1] = axis[1][y], xyz[2] = axis[2][z];
+  }
+
+  inline void get(uint64_t morton, float* xyz) const
+  {
+    uint32_t x, y, z;
+    morton_decode(morton, x, y, z);
+    get(x, y, z, xyz);
+  }
+};
+
+// Candidates tested together by the candidate overload
+const uint64_t BLOCK_SIZE = 512;
+// Octree nodes of at most LEAF_SIZE voxels are tested voxel by voxel
+const uint64_t LEAF_SIZE = 64;
+
+inline void set_bits(uint64_t* bits, uint64_t m0, uint64_t size)
 {
-  QList<uint64_t> voxels[2];
-  voxels[0].reserve(model.morton_length);
+  if (size >= 64)
+    std::fill(bits + (m0 >> 6), bits + ((m0 + size) >> 6), ~0x0ull);
+  else
+    bits[m0 >> 6] |= ((0x1ull << size) - 1) << (m0 & 63);
+}
+
+//
+// Octree carving of one subtree
+//
+// A node (a Morton range of 8^k voxels) is tested against the views that
+// did not decide its parent. Outside any of them leaves the node empty,
+// inside all of them fills it. Otherwise the node is split into its 8
+// children, down to leaves that are tested voxel by voxel.
+//
+struct HullCarver {
+  const std::vector<Silhouette>& silhouettes;
+  const VoxelCenters& vcenters;
+  const std::vector<uint32_t>& leaf_offsets; // coordinates of the voxels of a leaf
+  uint64_t* occupancy;
+
+  std::vector<std::vector<int> > views; // undecided views per depth
+  std::vector<float> centers, xs, ys, ws;
 
-  for (uint64_t m = 0, ms = model.morton_length; m < ms; ++m) {
-    voxels[0].append(m);
+  HullCarver(const std::vector<Silhouette>& sils, const VoxelCenters& vc,
+             const std::vector<uint32_t>& offsets, uint64_t* bits, int max_depth)
+  : silhouettes(sils), vcenters(vc), leaf_offsets(offsets), occupancy(bits)
+  , views(max_depth + 2)
+  {
+    for (int v = 0, n = (int)silhouettes.size(); v < n; ++v)
+      views[0].push_back(v);
   }
 
-  int current_voxel_list = 0;
-  for (int cam_i = 0, cam_n = cameras.size(); cam_i < cam_n; ++cam_i) {
-    Camera cam = cameras[cam_i];
-    QImage mask = QImage(cam.maskPath());
+  void carve(uint64_t m0, uint64_t size, int depth)
+  {
+    uint32_t p0[3], p1[3];
+    morton_decode(m0, p0[0], p0[1], p0[2]);
+    morton_decode(m0 + size - 1, p1[0], p1[1], p1[2]);
+    // centers of the first and the last voxel bound all of them, the
+    // sphere around the node bounds the spheres around its voxels
+    float lo[3], hi[3];
+    vcenters.get(p0[0], p0[1], p0[2], lo);
+    vcenters.get(p1[0], p1[1], p1[2], hi);
+    alignas(16) float center[3];
+    float diag = 0.0f;
+    for (int c = 0; c < 3; ++c) {
+      center[c] = 0.5f * (lo[c] + hi[c]);
+      diag += (hi[c] - lo[c]) * (hi[c] - lo[c]);
+    }
+    const float radius = 0.5f * sqrtf(diag) + vcenters.radius;
 
-    Mat4 extrinsic = cam.extrinsic();
-    Mat4 intrinsic = cam.intrinsicForImage(mask.width(), mask.height());
-    Mat4 transform = intrinsic * extrinsic;
+    const std::vector<int>& parent = views[depth];
+    std::vector<int>& undecided = views[depth + 1];
+    undecided.clear();
+    for (int v : parent) {
+      const Silhouette& sil = silhouettes[v];
+      float x, y, w;
+      project_points(sil.transform, center, 1, &x, &y, &w);
+      BoxTest t = sil.test_sphere(x, y, w, radius);
+      if (t == BoxTest::Outside)
+        return;
+      if (t == BoxTest::Partial)
+        undecided.push_back(v);
+    }
 
-    QList<uint64_t>& old_voxels = voxels[current_voxel_list];
-    QList<uint64_t>& new_voxels = voxels[(current_voxel_list + 1) % 2];
-    new_voxels.clear();
-    new_voxels.reserve(old_voxels.size());
+    if (undecided.empty()) {
+      set_bits(occupancy, m0, size);
+    } else if (size > LEAF_SIZE) {
+      const uint64_t child = size / 8;
+      for (int k = 0; k < 8; ++k)
+        carve(m0 + k * child, child, depth + 1);
+    } else {
+      carve_leaf(m0, (int)size, p0, undecided);
+    }
+  }
 
-    for (uint64_t morton : old_voxels) {
-      AABox vbox = model.element_box(morton);
-      Vec3 pos = (Vec3)vbox.center();
-      pos = Vec3::proj(transform * Vec4(pos, 1.0f));
+  void carve_leaf(uint64_t m0, int n, const uint32_t* p0, const std::vector<int>& undecided)
+  {
+    centers.resize(3 * n);
+    xs.resize(n), ys.resize(n), ws.resize(n);
+    for (int i = 0; i < n; ++i) {
+      const uint32_t* d = &leaf_offsets[3 * i];
+      vcenters.get(p0[0] + d[0], p0[1] + d[1], p0[2] + d[2], &centers[3 * i]);
+    }
 
-      QPoint pt2d = QPoint((float)pos.x(), (float)pos.y());
-      if (mask.valid(pt2d)) {
-        if (qGray(mask.pixel(pt2d)) > 100) {
-          new_voxels.append(morton);
-        }
+    uint64_t in = (n >= 64 ? ~0x0ull : (0x1ull << n) - 1);
+    for (int v : undecided) {
+      const Silhouette& sil = silhouettes[v];
+      project_points(sil.transform, centers.data(), n, xs.data(), ys.data(), ws.data());
+      for (int i = 0; i < n; ++i) {
+        if (sil.test_sphere(xs[i], ys[i], ws[i], vcenters.radius) == BoxTest::Outside)
+          in &= ~(0x1ull << i);
       }
+      if (!in)
+        return;
     }
+    occupancy[m0 >> 6] |= in << (m0 & 63);
+  }
+};
+
+}
+
+//
+// Subtrees of 1/512 of the grid (at least one leaf) are carved in parallel.
+// The tests scale with the surface of the hull: nodes entirely inside or
+// outside are decided by one lookup per view.
+//
+VoxelList visual_hull(const VoxelModel& model, const QList<Camera>& cameras,
+                      int num_threads)
+{
+  ThreadPool pool(num_threads);
+  std::vector<Silhouette> silhouettes = load_silhouettes(cameras, pool);
+  VoxelCenters vcenters(model);
+
+  const uint64_t length = model.morton_length;
+  std::vector<uint64_t> occupancy(std::max<uint64_t>(1, length / 64), 0);
+
+  const uint64_t leaf_size = std::min(LEAF_SIZE, length);
+  std::vector<uint32_t> leaf_offsets(3 * leaf_size);
+  for (uint64_t i = 0; i < leaf_size; ++i)
+    morton_decode(i, leaf_offsets[3 * i + 0], leaf_offsets[3 * i + 1], leaf_offsets[3 * i + 2]);
+
+  const uint64_t task_size = std::max(leaf_size, length >> 9);
+  pool.run(length / task_size, [&](uint64_t task, int) {
+    HullCarver carver(silhouettes, vcenters, leaf_offsets, occupancy.data(), model.level);
+    carver.carve(task * task_size, task_size, 0);
+  });
 
-    current_voxel_list = (current_voxel_list + 1) % 2;
+  VoxelList voxels;
+  for (size_t k = 0; k < occupancy.size(); ++k) {
+    for (uint64_t word = occupancy[k]; word; word &= word - 1)
+      voxels.append(k * 64 + __builtin_ctzll(word));
   }
+  return voxels;
+}
+
+VoxelList visual_hull(const VoxelModel& model, const QList<Camera>& cameras,
+                      const VoxelList& candidates, int num_threads)
+{
+  ThreadPool pool(num_threads);
+  std::vector<Silhouette> silhouettes = load_silhouettes(cameras, pool);
+  VoxelCenters vcenters(model);
 
-  return voxels[current_voxel_list];
+  // blocks of candidates tested in parallel, kept flags in candidate order
+  const uint64_t n = candidates.size();
+  std::vector<uint8_t> kept(n, 0);
+
+  pool.parallel_for(0, n, BLOCK_SIZE, [&](uint64_t i0, uint64_t i1, int) {
+    int count = (int)(i1 - i0);
+    std::vector<float> centers(3 * count), xs(count), ys(count), ws(count);
+    for (int i = 0; i < count; ++i) {
+      vcenters.get(candidates[(int)(i0 + i)], &centers[3 * i]);
+      kept[i0 + i] = 1;
+    }
+    for (const Silhouette& sil : silhouettes) {
+      project_points(sil.transform, centers.data(), count, xs.data(), ys.data(), ws.data());
+      for (int i = 0; i < count; ++i) {
+        if (sil.test_sphere(xs[i], ys[i], ws[i], vcenters.radius) == BoxTest::Outside)
+          kept[i0 + i] = 0;
+      }
+    }
+  });
+
+  VoxelList hull;
+  for (uint64_t i = 0; i < n; ++i) {
+    if (kept[i])
+      hull.append(candidates[(int)i]);
+  }
+  return hull;
 }
 
 }
@@ -1,43 +1,54 @@
 #include "VoxelScore1.h"
+#include <math.h>
 
 namespace recon {
 
-ClosestCameras::ClosestCameras(const QList<Camera>& cams, const QList<QImage>& imgs, int i, Point3 x)
+CameraTable::CameraTable(const QList<Camera>& cams, const ImageStore& imgs)
+{
+  txfms.reserve(cams.size());
+  centers.reserve(cams.size());
+  for (int i = 0, n = cams.size(); i < n; ++i) {
+    const Camera& cam = cams.at(i);
+    txfms.push_back(cam.intrinsicForImage(imgs.width(i), imgs.height(i)) * cam.extrinsic());
+    centers.push_back(cam.center());
+  }
+}
+
+// Neighbour ranges of ClosestCameras, cos of 10, 20 and 25 deg
+static const float COS_10DEG = 0.984807753012208f;
+static const float COS_20DEG = 0.9396926207859084f;
+static const float COS_25DEG = 0.9063077870366499f;
+
+ClosestCameras::ClosestCameras(const CameraTable& table, const ImageStore& imgs, int i, Point3 x,
+                               const std::vector<int>* candidates)
 : num(0)
 , cam_i(i)
-, _cameras(&cams)
+, txfm_i(table.txfms[i])
 , _images(&imgs)
 {
-  Camera ci = cams.at(i);
-  QImage img = imgs.at(i);
-  Mat4 m = ci.intrinsicForImage(img.width(), img.height());
-  txfm_i = m * ci.extrinsic();
-
-  append_cameras(x, 0.9396926207859084f, 0.984807753012208f); // 10 - 20 deg
-  //append_cameras(x, 0.984807753012208f, 0.9961946980917455f); // 5 - 10 deg
-  append_cameras(x, 0.9063077870366499f, 0.9396926207859084f); // 20 - 25 deg
+  append_cameras(table, candidates, x, COS_20DEG, COS_10DEG); // 10 - 20 deg
+  //append_cameras(table, candidates, x, 0.984807753012208f, 0.9961946980917455f); // 5 - 10 deg
+  append_cameras(table, candidates, x, COS_25DEG, COS_20DEG); // 20 - 25 deg
 }
 
-bool ClosestCameras::append_cameras(Point3 x, float cos_min, float cos_max)
+bool ClosestCameras::append_cameras(const CameraTable& table, const std::vector<int>* candidates,
+                                    Point3 x, float cos_min, float cos_max)
 {
   if (this->num >= MAX_NUM)
     return false;
 
-  Camera ci = _cameras->at(cam_i);
-  Vec3 ni = normalize(ci.center() - x);
+  Vec3 ni = normalize(table.centers[cam_i] - x);
   int count = this->num;
 
-  for (int j = 0, n = _cameras->size(); j < n; ++j) {
-    Camera cj = _cameras->at(j);
-    QImage img = _images->at(j);
-    int w = img.width(), h = img.height();
-    Vec3 nj = normalize(cj.center() - x);
+  int n = (candidates ? (int)candidates->size() : table.size());
+  for (int k = 0; k < n; ++k) {
+    int j = (candidates ? (*candidates)[k] : k);
+    Vec3 nj = normalize(table.centers[j] - x);
     float dp = (float)dot(ni, nj);
 
     if (dp <= cos_max && dp >= cos_min) {
-      Mat4 txfm = cj.intrinsicForImage(w, h) * cj.extrinsic();
       this->cam_js[count] = j;
-      this->txfm_js[count] = txfm;
+      this->txfm_js[count] = table.txfms[j];
       count++;
       if (count == MAX_NUM)
         break;
@@ -47,6 +58,52 @@ bool ClosestCameras::append_cameras(Point3 x, float cos_min, float cos_max)
   return true;
 }
 
+void ClosestCameras::find_candidates(const CameraTable& table, Point3 center, float radius,
+                                     std::vector<std::vector<int> >& candidates)
+{
+  std::vector<Vec3> dirs;
+  std::vector<float> turns;
+  find_candidates(table, center, radius, candidates, dirs, turns);
+}
+
+void ClosestCameras::find_candidates(const CameraTable& table, Point3 center, float radius,
+                                     std::vector<std::vector<int> >& candidates,
+                                     std::vector<Vec3>& dirs, std::vector<float>& turns)
+{
+  // slack for rounding of the cos tests
+  const float EPS = 1e-3f;
+  const float angle_min = acosf(COS_10DEG) - EPS;
+  const float angle_max = acosf(COS_25DEG) + EPS;
+
+  int n = table.size();
+  dirs.resize(n);
+  turns.resize(n);
+  for (int i = 0; i < n; ++i) {
+    Vec3 v = table.centers[i] - center;
+    float dist = (float)length(v);
+    dirs[i] = v / dist;
+    turns[i] = (radius < dist ? asinf(radius / dist) : (float)M_PI);
+  }
+
+  candidates.resize(n);
+  for (int i = 0; i < n; ++i) {
+    std::vector<int>& list = candidates[i];
+    list.clear();
+    for (int j = 0; j < n; ++j) {
+      if (j == i)
+        continue;
+      float dp = fminf(fmaxf((float)dot(dirs[i], dirs[j]), -1.0f), 1.0f);
+      float angle = acosf(dp);
+      float turn = turns[i] + turns[j];
+      if (angle + turn >= angle_min && angle - turn <= angle_max)
+        list.push_back(j);
+    }
+  }
+}
+
+// Steps of the epipolar sweeps of the thread, reused by every VoxelScore1
+static thread_local EpipolarSteps thread_steps;
+
 struct PeakFinder {
   constexpr static int N = 5;
   float xbuf[N];
@@ -90,58 +147,82 @@ struct PeakFinder {
 
 VoxelScore1::
 VoxelScore1(const QList<Camera>& cams,
-            const QList<QImage>& imgs,
+            const ImageStore& imgs,
             int cam_i, Point3 x, float voxel_h)
+: VoxelScore1(CameraTable(cams, imgs), imgs, cam_i, x, voxel_h)
+{
+}
+
+VoxelScore1::
+VoxelScore1(const CameraTable& table,
+            const ImageStore& imgs,
+            int cam_i, Point3 x, float voxel_h,
+            const std::vector<int>* candidates,
+            const Vec3* xy_i,
+            float margin)
 : voxel_size(voxel_h)
-, ccams(cams, imgs, cam_i, x)
+, ccams(table, imgs, cam_i, x, candidates)
 {
-  const Camera& ci = cams.at(cam_i);
-  const QImage& image_i = imgs.at(cam_i);
-  swin_i = SampleWindow(image_i, Vec3::proj(transform(ccams.txfm_i, x)));
-  ray = Ray3(x, normalize(ci.center() - x) * voxel_h * 0.707f);
+  const GrayImage& image_i = imgs.at(cam_i);
+  swin_i = SampleWindow(image_i, xy_i ? *xy_i : Vec3::proj(transform(ccams.txfm_i, x)));
+  zref_i = ZnccReference(swin_i);
+  ray = Ray3(x, normalize(table.centers[cam_i] - x) * voxel_h * 0.707f);
 
-  sjdk.reserve(16);
   for (int i = 0; i < ccams.num; ++i) {
-    find_peaks(i);
+    find_peaks(i, 3.0f + margin);
   }
   std::sort(sjdk.begin(), sjdk.end(),
-            [](QPointF a, QPointF b){ return a.x() < b.x(); });
+            [](const PeakList::Peak& a, const PeakList::Peak& b){ return a.depth < b.depth; });
 }
 
-Epipolar VoxelScore1::make_epipolar(int ith_jcam) const
+Epipolar VoxelScore1::make_epipolar(int ith_jcam, float d0) const
 {
   int cam_j = ccams.cam_js[ith_jcam];
   Mat4 txfm_j = ccams.txfm_js[ith_jcam];
 
-  const QImage& image_j = ccams._images->at(cam_j);
-  int width = image_j.width(), height = image_j.height();
+  int width = ccams._images->width(cam_j), height = ccams._images->height(cam_j);
 
-  return Epipolar(width, height, txfm_j, ray);
+  return Epipolar(width, height, txfm_j, (d0 == 0.0f ? ray : Ray3(ray[d0], ray.diff)));
 }
 
-void VoxelScore1::find_peaks(int ith_jcam)
+void VoxelScore1::find_peaks(int ith_jcam, float drange)
 {
   int cam_j = ccams.cam_js[ith_jcam];
-  const QImage& image_j = ccams._images->at(cam_j);
+  const GrayImage& image_j = ccams._images->at(cam_j);
   auto epipolar = make_epipolar(ith_jcam);
 
   PeakFinder peak;
-  epipolar.per_pixel<false>(
-    [&peak,&image_j,this,&epipolar]
-    (Vec3 pt0, Vec3 pt1) {
-      float depth = (float)pt0.z();
-      SampleWindow swj(image_j, pt0);
-      float ncc = NormalizedCrossCorrelation(swin_i, swj);
-      peak.push(depth, ncc);
+  if (RectifiedEpipolar) {
+    // one strip per thread, its buffers are reused by every sweep
+    static thread_local EpipolarStrip strip;
+    strip.correlate(image_j, epipolar, zref_i, drange);
+    for (int s = 0, n = (int)strip.ncc.size(); s < n; ++s) {
+      peak.push(strip.steps.depth[s], strip.ncc[s]);
       if (peak.valid()) {
         // NOTE: Hard threshold for peaks
         if (peak.y() > 0.5f)
-          sjdk.append(QPointF(peak.x(), peak.y()));
+          sjdk.append(peak.x(), (float)peak.y());
       }
     }
-  , 3.0f);
+    return;
+  }
+
+  EpipolarSteps& steps = thread_steps;
+  epipolar.steps(drange, steps);
+  for (int s = 0, n = steps.size(); s < n; ++s) {
+    SampleWindow swj(image_j, Vec3(steps.x[s], steps.y[s], 0.0f));
+    float ncc = zncc(zref_i, swj);
+    peak.push(steps.depth[s], ncc);
+    if (peak.valid()) {
+      // NOTE: Hard threshold for peaks
+      if (peak.y() > 0.5f)
+        sjdk.append(peak.x(), (float)peak.y());
+    }
+  }
 }
 
+bool VoxelScore1::RectifiedEpipolar = false;
+
 double VoxelScore1::parzen_window(float x)
 {
   //const double sigma = 1.0;
@@ -153,40 +234,43 @@ double VoxelScore1::parzen_window(float x)
 double VoxelScore1::compute(float d) const
 {
   double sum = 0.0;
-  for (QPointF ds : sjdk) {
-    float dk = ds.x();
-    double sidk = ds.y();
+  for (const PeakList::Peak& ds : sjdk) {
+    float dk = ds.depth;
+    double sidk = ds.ncc;
     sum += sidk * parzen_window(d - dk);
   }
   return sum;
 }
 
 double VoxelScore1::vote() const
+{
+  return vote(0.0f);
+}
+
+double VoxelScore1::vote(float d0) const
 {
   if (ccams.num < 1)
     return 0.0;
 
-  double c0 = compute(0.0);
+  // depths d0 + z, z along the epipolar lines from d0
+  EpipolarSteps& steps = thread_steps;
+  double c0 = compute(d0);
   for (int i = 0; i < ccams.num; ++i) {
-    auto epipolar = make_epipolar(i);
-    epipolar.per_pixel<false>(
-      [&c0,this](Vec3 pt0, Vec3 pt1){
-        float d = (float)pt0.z();
-        if (fabsf(d) <= 1.0f)
-          c0 = fmax(c0, compute(d));
-      },
-    1.0f);
+    make_epipolar(i, d0).steps(1.0f, steps);
+    for (int s = 0, n = steps.size(); s < n; ++s) {
+      float z = steps.depth[s];
+      if (fabsf(z) <= 1.0f)
+        c0 = fmax(c0, compute(d0 + z));
+    }
   }
 
   bool ok = true;
   for (int i = 0; i < ccams.num && ok; ++i) {
-    auto epipolar = make_epipolar(i);
-    epipolar.per_pixel<false>(
-      [c0,&ok,this](Vec3 pt0, Vec3 pt1){
-        float c = compute((float)pt0.z());
-        ok = ok && (c0 >= c);
-      },
-    3.0f);
+    make_epipolar(i, d0).steps(3.0f, steps);
+    for (int s = 0, n = steps.size(); s < n && ok; ++s) {
+      float c = compute(d0 + steps.depth[s]);
+      ok = (c0 >= c);
+    }
   }
 
   return (ok ? c0 : 0.0);
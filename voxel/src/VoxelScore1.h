@@ -4,12 +4,28 @@
 #include "VoxelModel.h"
 #include "Epipolar.h"
 #include "Correlation.h"
+#include "Zncc.h"
+#include "EpipolarStrip.h"
+#include "ImageStore.h"
 #include <QList>
-#include <QImage>
 #include <iterator>
+#include <vector>
 
 namespace recon {
 
+//
+// Projection matrices and centers of the views, computed once
+//
+struct CameraTable {
+  std::vector<Mat4> txfms; // intrinsicForImage(image size) * extrinsic()
+  std::vector<Point3> centers;
+
+  CameraTable() {}
+  CameraTable(const QList<Camera>& cams, const ImageStore& imgs);
+
+  inline int size() const { return (int)centers.size(); }
+};
+
 struct ClosestCameras {
   static const int MAX_NUM = 4;
   int num;
@@ -17,29 +33,112 @@ struct ClosestCameras {
   int cam_js[MAX_NUM];
   Mat4 txfm_i;
   Mat4 txfm_js[MAX_NUM];
-  const QList<Camera>* _cameras;
-  const QList<QImage>* _images;
+  const ImageStore* _images;
+
+  // candidates: views tested as neighbours in ascending order (as from
+  // find_candidates), nullptr tests every view
+  ClosestCameras(const CameraTable& table, const ImageStore& imgs, int i, Point3 x,
+                 const std::vector<int>* candidates = nullptr);
+  bool append_cameras(const CameraTable& table, const std::vector<int>* candidates,
+                      Point3 x, float cos_min, float cos_max);
+
+  //
+  // Views that can be a neighbour of each view anywhere in a sphere
+  //
+  // From a point moved by at most radius, the direction to a view at
+  // distance D turns by at most asin(radius / D), so the angle between two
+  // views changes by at most the sum of their turns. Views whose angle at
+  // center cannot reach the neighbour ranges are left out, which picks the
+  // same neighbours as testing every view.
+  //
+  static void find_candidates(const CameraTable& table, Point3 center, float radius,
+                              std::vector<std::vector<int> >& candidates);
+  // Same with the directions and turns of the views in dirs and turns,
+  // reused between calls
+  static void find_candidates(const CameraTable& table, Point3 center, float radius,
+                              std::vector<std::vector<int> >& candidates,
+                              std::vector<Vec3>& dirs, std::vector<float>& turns);
+};
 
-  ClosestCameras(const QList<Camera>& cams, const QList<QImage>& imgs, int i, Point3 x);
-  bool append_cameras(Point3 x, float cos_min, float cos_max);
+//
+// Peaks (depth, ZNCC) of the epipolar sweeps of a VoxelScore1
+//
+// Up to CAPACITY peaks are kept in place, more than that (long epipolar
+// segments at coarse levels) move to the heap.
+//
+class PeakList {
+public:
+  struct Peak {
+    float depth;
+    float ncc;
+  };
+  static const int CAPACITY = 64;
+
+  PeakList() : m_Size(0) {}
+
+  inline int size() const { return m_Size; }
+  inline bool overflowed() const { return m_Size > CAPACITY; }
+  inline const Peak* begin() const { return data(); }
+  inline const Peak* end() const { return data() + m_Size; }
+  inline Peak* begin() { return data(); }
+  inline Peak* end() { return data() + m_Size; }
+
+  inline void append(float depth, float ncc)
+  {
+    if (m_Size < CAPACITY) {
+      m_Peaks[m_Size].depth = depth, m_Peaks[m_Size].ncc = ncc;
+    } else {
+      if (m_Size == CAPACITY)
+        m_Overflow.assign(m_Peaks, m_Peaks + CAPACITY);
+      m_Overflow.push_back(Peak{ depth, ncc });
+    }
+    m_Size++;
+  }
+
+private:
+  inline const Peak* data() const { return (m_Size <= CAPACITY ? m_Peaks : m_Overflow.data()); }
+  inline Peak* data() { return (m_Size <= CAPACITY ? m_Peaks : m_Overflow.data()); }
+
+  int m_Size;
+  Peak m_Peaks[CAPACITY];
+  std::vector<Peak> m_Overflow; // every peak once there are more than CAPACITY
 };
 
 struct VoxelScore1 {
   float voxel_size;
   ClosestCameras ccams;
   SampleWindow swin_i;
+  ZnccReference zref_i; // swin_i prepared for the epipolar sweeps
   Ray3 ray;
-  QList<QPointF> sjdk;
+  PeakList sjdk; // ascending depths
 
   VoxelScore1(const QList<Camera>& cams,
-              const QList<QImage>& imgs,
+              const ImageStore& imgs,
               int cam_i, Point3 x, float voxel_h);
+  // xy_i: x projected into view i if known (project_points)
+  // margin: peaks are searched that much further along the ray, for votes
+  // of points up to margin from x (vote(d))
+  // Views cam_i and the candidates must be pinned in imgs (ImageStore::pin)
+  VoxelScore1(const CameraTable& table,
+              const ImageStore& imgs,
+              int cam_i, Point3 x, float voxel_h,
+              const std::vector<int>* candidates = nullptr,
+              const Vec3* xy_i = nullptr,
+              float margin = 0.0f);
   double compute(float d) const;
   double vote() const;
+  // Vote of the point at depth d along the ray, |d| <= margin, from the
+  // windows and peaks of x
+  double vote(float d) const;
+
+  // Correlate along the epipolar lines on rectified strips (EpipolarStrip)
+  // instead of sampling an axis-aligned window per step
+  static bool RectifiedEpipolar;
 
 private:
-  inline Epipolar make_epipolar(int ith_jcam) const;
-  inline void find_peaks(int ith_jcam);
+  // Ray from depth d0
+  inline Epipolar make_epipolar(int ith_jcam, float d0 = 0.0f) const;
+  inline void find_peaks(int ith_jcam, float drange);
   static inline double parzen_window(float x);
 };
 
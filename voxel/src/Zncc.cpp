@@ -0,0 +1,137 @@
+#include "Zncc.h"
+#include <immintrin.h>
+#include <math.h>
+
+namespace recon {
+
+// Samples of a window handled by the vector loops, the last one is scalar
+static const int ZNCC_BODY = 120;
+
+ZnccReference::ZnccReference(const SampleWindow& window)
+: valid(window.valid)
+{
+  double sum = 0.0;
+  for (int i = 0; i < 121; ++i)
+    sum += window.gray[i];
+  float mean = (float)(sum / 121.0);
+
+  double norm = 0.0;
+  for (int i = 0; i < 121; ++i) {
+    v[i] = window.gray[i] - mean;
+    norm += (double)v[i] * v[i];
+  }
+  // a flat reference gives NaN, as in NormalizedCrossCorrelation
+  float scale = 1.0f / (float)sqrt(norm);
+  for (int i = 0; i < 121; ++i)
+    v[i] *= scale;
+  for (int i = 121; i < 128; ++i)
+    v[i] = 0.0f;
+}
+
+static float zncc_scalar(const float* v, const float* y)
+{
+  float sum = 0.0f;
+  for (int i = 0; i < 121; ++i)
+    sum += y[i];
+  float mean = sum / 121.0f;
+
+  float ss = 0.0f, dp = 0.0f;
+  for (int i = 0; i < 121; ++i) {
+    float d = y[i] - mean;
+    ss += d * d;
+    dp += v[i] * d;
+  }
+  return dp / sqrtf(ss);
+}
+
+static inline float hsum_ps(__m128 a)
+{
+  __m128 b = _mm_add_ps(a, _mm_movehl_ps(a, a));
+  b = _mm_add_ss(b, _mm_shuffle_ps(b, b, 0x55));
+  return _mm_cvtss_f32(b);
+}
+
+static float zncc_sse(const float* v, const float* y)
+{
+  __m128 s0 = _mm_setzero_ps(), s1 = _mm_setzero_ps();
+  for (int i = 0; i < ZNCC_BODY; i += 8) {
+    s0 = _mm_add_ps(s0, _mm_loadu_ps(y + i));
+    s1 = _mm_add_ps(s1, _mm_loadu_ps(y + i + 4));
+  }
+  float mean = (hsum_ps(_mm_add_ps(s0, s1)) + y[ZNCC_BODY]) / 121.0f;
+
+  const __m128 vmean = _mm_set1_ps(mean);
+  __m128 ss = _mm_setzero_ps(), dp = _mm_setzero_ps();
+  for (int i = 0; i < ZNCC_BODY; i += 4) {
+    __m128 d = _mm_sub_ps(_mm_loadu_ps(y + i), vmean);
+    ss = _mm_add_ps(ss, _mm_mul_ps(d, d));
+    dp = _mm_add_ps(dp, _mm_mul_ps(_mm_loadu_ps(v + i), d));
+  }
+  float d = y[ZNCC_BODY] - mean;
+  return (hsum_ps(dp) + v[ZNCC_BODY] * d) / sqrtf(hsum_ps(ss) + d * d);
+}
+
+__attribute__((target("avx2,fma")))
+static float zncc_avx2(const float* v, const float* y)
+{
+  __m256 s = _mm256_setzero_ps();
+  for (int i = 0; i < ZNCC_BODY; i += 8)
+    s = _mm256_add_ps(s, _mm256_loadu_ps(y + i));
+  __m128 s4 = _mm_add_ps(_mm256_castps256_ps128(s), _mm256_extractf128_ps(s, 1));
+  float mean = (hsum_ps(s4) + y[ZNCC_BODY]) / 121.0f;
+
+  const __m256 vmean = _mm256_set1_ps(mean);
+  __m256 ss = _mm256_setzero_ps(), dp = _mm256_setzero_ps();
+  for (int i = 0; i < ZNCC_BODY; i += 8) {
+    __m256 d = _mm256_sub_ps(_mm256_loadu_ps(y + i), vmean);
+    ss = _mm256_fmadd_ps(d, d, ss);
+    dp = _mm256_fmadd_ps(_mm256_loadu_ps(v + i), d, dp);
+  }
+  __m128 ss4 = _mm_add_ps(_mm256_castps256_ps128(ss), _mm256_extractf128_ps(ss, 1));
+  __m128 dp4 = _mm_add_ps(_mm256_castps256_ps128(dp), _mm256_extractf128_ps(dp, 1));
+  float d = y[ZNCC_BODY] - mean;
+  return (hsum_ps(dp4) + v[ZNCC_BODY] * d) / sqrtf(hsum_ps(ss4) + d * d);
+}
+
+typedef float (*ZnccFunc)(const float*, const float*);
+
+bool zncc_kernel_supported(ZnccKernel kernel)
+{
+  if (kernel == ZnccKernel::AVX2) {
+    __builtin_cpu_init(); // may run before the constructors
+    return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+  }
+  return true;
+}
+
+// SSE by default: AVX2 with FMA rounds differently, and the votes must not
+// depend on the machine building the graph
+static ZnccKernel g_ZnccKernel = ZnccKernel::SSE;
+static ZnccFunc g_ZnccFunc = zncc_sse;
+
+ZnccKernel zncc_kernel()
+{
+  return g_ZnccKernel;
+}
+
+void set_zncc_kernel(ZnccKernel kernel)
+{
+  if (!zncc_kernel_supported(kernel))
+    kernel = ZnccKernel::SSE;
+
+  g_ZnccKernel = kernel;
+  switch (kernel) {
+  case ZnccKernel::Scalar: g_ZnccFunc = zncc_scalar; break;
+  case ZnccKernel::AVX2: g_ZnccFunc = zncc_avx2; break;
+  default: g_ZnccFunc = zncc_sse; break;
+  }
+}
+
+float zncc(const ZnccReference& ref, const SampleWindow& window)
+{
+  if (!ref.valid || !window.valid)
+    return -1.0f;
+  return g_ZnccFunc(ref.v, window.gray);
+}
+
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include "Correlation.h"
+
+namespace recon {
+
+//
+// Reference window of ZNCC, prepared once
+//
+// The samples are stored zero-mean and scaled to unit norm, so correlating
+// another window only needs its mean, its norm and one dot product:
+//   zncc(ref, w) = dot(v, w - mean(w)) / |w - mean(w)|
+//
+struct ZnccReference {
+  bool valid;
+  float v[128]; // 121 samples, zero padded
+
+  ZnccReference()
+  : valid(false)
+  {
+  }
+
+  explicit ZnccReference(const SampleWindow& window);
+};
+
+enum class ZnccKernel {
+  Scalar,
+  SSE,
+  AVX2 // with FMA, opt-in: rounds differently from SSE
+};
+
+// -1 if either window is invalid, like NormalizedCrossCorrelation
+float zncc(const ZnccReference& ref, const SampleWindow& window);
+
+// Kernel used by zncc() (SSE by default); set_zncc_kernel falls back to
+// SSE if the CPU lacks AVX2 and must not race with running correlations
+ZnccKernel zncc_kernel();
+void set_zncc_kernel(ZnccKernel kernel);
+bool zncc_kernel_supported(ZnccKernel kernel);
+
+}
@@ -1,6 +1,7 @@
 #include <recon/CameraLoader.h>
 #include <recon/BuildGraph.h>
 #include "../src/PhotoConsistency.h"
+#include "../src/AllocationCount.h"
 #include <QCommandLineParser>
 #include <QCoreApplication>
 #include <QDir>
@@ -10,9 +11,37 @@
 #include <QTextStream>
 #include <stdlib.h>
 #include <iostream>
+#include <new>
+
+// Count every heap allocation per thread, build_graph reports those of
+// the votes once their scratch buffers have stopped growing
+void* operator new(size_t size)
+{
+  recon::count_allocation();
+  if (void* p = malloc(size ? size : 1))
+    return p;
+  throw std::bad_alloc();
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept
+{
+  recon::count_allocation();
+  return malloc(size ? size : 1);
+}
+
+void operator delete(void* p) noexcept
+{
+  free(p);
+}
+
+void operator delete(void* p, const std::nothrow_t&) noexcept
+{
+  free(p);
+}
 
 int main(int argc, char* argv[])
 {
+  recon::enable_allocation_count();
   QCoreApplication app(argc, argv);
   QCoreApplication::setApplicationName("build-graph");
   QCoreApplication::setApplicationVersion("1.0");
@@ -22,7 +51,7 @@ int main(int argc, char* argv[])
   parser.addHelpOption();
   parser.addVersionOption();
   parser.addPositionalArgument("bundle", "Input bundle file");
-  parser.addPositionalArgument("data", "Output text file");
+  parser.addPositionalArgument("data", "Output graph file");
 
   QCommandLineOption optLevel(QStringList() << "l" << "level", "Level", "level");
   optLevel.setDefaultValue("7");
@@ -32,6 +61,30 @@ int main(int argc, char* argv[])
   parser.addOption(optThreshold);
   QCommandLineOption optDisableAutoThreshold("no-auto-threshold", "Disable Automatic Thresholding");
   parser.addOption(optDisableAutoThreshold);
+  QCommandLineOption optRectified("rectified", "Correlate on strips rectified along the epipolar lines");
+  parser.addOption(optRectified);
+  QCommandLineOption optAvx2("avx2", "Correlate with AVX2 and FMA if the CPU has them (rounds differently)");
+  parser.addOption(optAvx2);
+  QCommandLineOption optSharedFaces("shared-faces", "Vote the faces of a voxel from one evaluation per view");
+  parser.addOption(optSharedFaces);
+  QCommandLineOption optVisibility("visibility", "Skip the views hidden from a point by the visual hull or coarser surface");
+  parser.addOption(optVisibility);
+  QCommandLineOption optDepthMaps("depth-maps", "Weight the edges from plane-sweep depth maps of every view");
+  parser.addOption(optDepthMaps);
+  QCommandLineOption optImageBudget("image-budget", "Megabytes of Images Kept in Memory (0 = all)", "MB");
+  optImageBudget.setDefaultValue("0");
+  parser.addOption(optImageBudget);
+  QCommandLineOption optMaxImageWidth("max-image-width", "Images Are Halved Until No Wider Than This (0 = never)", "width");
+  optMaxImageWidth.setDefaultValue("960");
+  parser.addOption(optMaxImageWidth);
+  QCommandLineOption optThreads(QStringList() << "j" << "threads", "Number of Threads (0 = all cores)", "threads");
+  optThreads.setDefaultValue("0");
+  parser.addOption(optThreads);
+  QCommandLineOption optFormat(QStringList() << "f" << "format", "Graph File Format (binary, float, text)", "format");
+  optFormat.setDefaultValue("binary");
+  parser.addOption(optFormat);
+  QCommandLineOption optSparse("sparse", "Store the graph in 8x8x8 bricks around the visual hull");
+  parser.addOption(optSparse);
 
   parser.process(app);
 
@@ -62,6 +115,19 @@ int main(int argc, char* argv[])
     cam.setMaskPath(mpath);
   }
 
+  recon::GraphFormat format = recon::GraphFormat::Binary;
+  {
+    QString fmt = parser.value(optFormat);
+    if (fmt == "text") {
+      format = recon::GraphFormat::Text;
+    } else if (fmt == "float") {
+      format = recon::GraphFormat::BinaryFloat;
+    } else if (fmt != "binary") {
+      std::cout << "Unknown graph format: " << fmt.toStdString() << "\n";
+      return 1;
+    }
+  }
+
   int level = parser.value(optLevel).toInt();
   printf("level = %d\n", level);
 
@@ -69,10 +135,27 @@ int main(int argc, char* argv[])
   PhotoConsistency::EnableAutoThresholding = !parser.isSet(optDisableAutoThreshold);
   if (parser.isSet(optThreshold))
     PhotoConsistency::VotingThreshold = parser.value(optThreshold).toDouble();
+  recon::VoxelScore1::RectifiedEpipolar = parser.isSet(optRectified);
+  if (parser.isSet(optAvx2))
+    recon::set_zncc_kernel(recon::ZnccKernel::AVX2);
+  PhotoConsistency::SharedFaceVotes = parser.isSet(optSharedFaces);
+  PhotoConsistency::UseVisibility = parser.isSet(optVisibility);
+  PhotoConsistency::DepthMapVotes = parser.isSet(optDepthMaps);
+  PhotoConsistency::ImageBudget = parser.value(optImageBudget).toInt();
+  PhotoConsistency::MaxImageWidth = parser.value(optMaxImageWidth).toInt();
 
   recon::VoxelModel model(level, loader.model_boundingbox());
-  recon::VoxelGraph graph;
-  recon::build_graph(graph, model, cameras);
-  recon::save_graph(graph, outputPath);
+  int num_threads = parser.value(optThreads).toInt();
+  if (parser.isSet(optSparse)) {
+    recon::SparseVoxelGraph graph;
+    recon::build_graph(graph, model, cameras, num_threads);
+    if (!recon::save_graph(graph, outputPath, format))
+      return 1;
+  } else {
+    recon::VoxelGraph graph;
+    recon::build_graph(graph, model, cameras, num_threads);
+    if (!recon::save_graph(graph, outputPath, format))
+      return 1;
+  }
   return 0;
 }
@@ -1,15 +1,248 @@
 #include <recon/GraphCut.h>
+#include "ThreadPool.h"
 
 #include <QCommandLineParser>
 #include <QCoreApplication>
 #include <QDir>
+#include <QElapsedTimer>
 #include <QString>
+#include <QStringList>
 #include <QtDebug>
 #include <QImage>
 #include <QFile>
 #include <QTextStream>
 #include <stdlib.h>
+#include <math.h>
+#include <algorithm>
 #include <iostream>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+using recon::GraphCutOptions;
+using recon::VoxelList;
+using recon::VoxelModel;
+
+// Cut with the given options and, if asked, report the difference to
+// the double precision solver (double neighbour weights and capacities)
+template<typename Graph>
+static VoxelList optimize(const Graph& graph, double lambda, double mju,
+                          const GraphCutOptions& options, bool compare)
+{
+  double flow;
+  VoxelList vlist = recon::graph_cut(graph, lambda, mju, options, &flow);
+  if (!compare || options.capacity == recon::CapacityType::Double)
+    return vlist;
+
+  GraphCutOptions reference = options;
+  reference.capacity = recon::CapacityType::Double;
+  double ref_flow;
+  VoxelList ref_vlist = recon::graph_cut(graph, lambda, mju, reference, &ref_flow);
+
+  std::unordered_set<uint64_t> a(vlist.begin(), vlist.end());
+  std::unordered_set<uint64_t> b(ref_vlist.begin(), ref_vlist.end());
+  int diff = 0;
+  for (uint64_t m : a)
+    diff += !b.count(m);
+  for (uint64_t m : b)
+    diff += !a.count(m);
+
+  printf("flow: %.9g (double %.9g, relative difference %.3g)\n",
+         flow, ref_flow, (ref_flow != 0.0 ? fabs(flow - ref_flow) / ref_flow : 0.0));
+  printf("surface: %d voxels (double %d, %d differ)\n",
+         vlist.size(), ref_vlist.size(), diff);
+  return vlist;
+}
+
+//
+// Parameter Sweep
+//
+
+struct SweepPoint {
+  double lambda;
+  double mju;
+  QString path;
+  double flow;
+  int surface;
+  double seconds;
+};
+
+static bool parse_values(const QString& text, std::vector<double>& values)
+{
+#if QT_VERSION >= QT_VERSION_CHECK(5, 14, 0)
+  const auto skip_empty = Qt::SkipEmptyParts;
+#else
+  const auto skip_empty = QString::SkipEmptyParts;
+#endif
+  values.clear();
+  for (const QString& item : text.split(',', skip_empty)) {
+    bool ok;
+    values.push_back(item.trimmed().toDouble(&ok));
+    if (!ok)
+      return false;
+  }
+  return !values.empty();
+}
+
+// Lambda indices in the order that brackets each one by the closest solved
+// lambdas: both ends first, then repeatedly the middle of every gap
+static std::vector<int> bisection_order(const std::vector<double>& lambdas)
+{
+  std::vector<int> sorted(lambdas.size());
+  for (size_t i = 0; i < sorted.size(); ++i)
+    sorted[i] = (int)i;
+  std::sort(sorted.begin(), sorted.end(), [&](int a, int b) { return lambdas[a] < lambdas[b]; });
+
+  std::vector<int> order;
+  if (sorted.empty())
+    return order;
+  order.push_back(sorted.front());
+  if (sorted.size() > 1)
+    order.push_back(sorted.back());
+  std::vector<std::pair<int, int> > gaps(1, std::make_pair(0, (int)sorted.size() - 1));
+  for (size_t k = 0; k < gaps.size(); ++k) {
+    int lo = gaps[k].first, hi = gaps[k].second;
+    if (hi - lo < 2)
+      continue;
+    int mid = (lo + hi) / 2;
+    order.push_back(sorted[mid]);
+    gaps.push_back(std::make_pair(lo, mid));
+    gaps.push_back(std::make_pair(mid, hi));
+  }
+  return order;
+}
+
+//
+// Cut the graph for every (lambda, mju) pair, writing one PLY per pair
+//
+// The pairs of one mju share a ParametricGraphCut, so each lambda after
+// the first two is solved only on the voxels between its neighbours'
+// cuts. Up to num_jobs cuts run at once, fewer if their estimated memory
+// would exceed memory_budget (in bytes, 0 = unlimited). With fewer mjus
+// than jobs, the sorted lambdas of each mju are split into contiguous
+// ranges with a cut of their own: a range cannot reuse the cuts of the
+// others, but the ranges run concurrently.
+//
+template<typename Graph>
+static void sweep(const Graph& graph, const VoxelModel& model,
+                  std::vector<SweepPoint>& points,
+                  const GraphCutOptions& options,
+                  int num_jobs, uint64_t memory_budget)
+{
+  // points of each mju, sorted by lambda
+  std::vector<double> mjus;
+  std::vector<std::vector<int> > groups;
+  for (size_t i = 0; i < points.size(); ++i) {
+    size_t g = std::find(mjus.begin(), mjus.end(), points[i].mju) - mjus.begin();
+    if (g == mjus.size()) {
+      mjus.push_back(points[i].mju);
+      groups.push_back(std::vector<int>());
+    }
+    groups[g].push_back((int)i);
+  }
+  size_t largest = 0;
+  for (std::vector<int>& group : groups) {
+    std::sort(group.begin(), group.end(),
+              [&](int a, int b) { return points[a].lambda < points[b].lambda; });
+    largest = std::max(largest, group.size());
+  }
+
+  // a cut of a whole group bounds the memory of any range
+  uint64_t memory = recon::parametric_cut_memory(graph, options, (int)largest);
+  int jobs = std::max(1, std::min(num_jobs, (int)points.size()));
+  if (memory_budget > 0 && memory > 0)
+    jobs = (int)std::max<uint64_t>(1, std::min<uint64_t>(jobs, memory_budget / memory));
+
+  // ranges of one cut: (group, first, last) into the sorted group
+  struct Range { size_t group, first, last; };
+  std::vector<Range> ranges;
+  const size_t parts = std::max<size_t>(1, jobs / groups.size());
+  for (size_t g = 0; g < groups.size(); ++g) {
+    const size_t n = groups[g].size(), k = std::min(parts, n);
+    for (size_t r = 0; r < k; ++r)
+      ranges.push_back(Range{ g, n * r / k, n * (r + 1) / k });
+  }
+  jobs = std::min(jobs, (int)ranges.size());
+  printf("sweep: %d pairs, %d mjus in %d cuts, %d at once, about %.1f MB each\n",
+         (int)points.size(), (int)groups.size(), (int)ranges.size(), jobs,
+         memory / (1024.0 * 1024.0));
+
+  recon::ThreadPool pool(jobs);
+  pool.run(ranges.size(), [&](uint64_t r, int) {
+    const Range& range = ranges[r];
+    const std::vector<int>& group = groups[range.group];
+    // integer capacities of the whole range are rounded at the scale of
+    // its largest lambda
+    recon::ParametricGraphCut cut(graph, mjus[range.group], options,
+                                  points[group[range.last - 1]].lambda);
+    std::vector<double> lambdas;
+    for (size_t k = range.first; k < range.last; ++k)
+      lambdas.push_back(points[group[k]].lambda);
+
+    for (int k : bisection_order(lambdas)) {
+      SweepPoint& p = points[group[range.first + k]];
+      QElapsedTimer timer;
+      timer.start();
+      VoxelList vlist = cut.cut(p.lambda, &p.flow);
+      p.surface = vlist.size();
+      p.seconds = timer.elapsed() / 1000.0;
+      recon::save_points_ply(p.path, model, vlist);
+      printf("lambda = %g, mju = %g: flow = %lf, %d surface voxels\n",
+             p.lambda, p.mju, p.flow, p.surface);
+    }
+  });
+}
+
+//
+// Read lambdas from the standard input and cut each one, reusing the
+// cuts of the lambdas before (empty line or end of input quits)
+//
+template<typename Graph>
+static void interactive(const Graph& graph, const VoxelModel& model, double mju,
+                        const GraphCutOptions& options, const QString& basePath)
+{
+  recon::ParametricGraphCut cut(graph, mju, options);
+  std::string line;
+  for (;;) {
+    std::cout << "lambda> " << std::flush;
+    if (!std::getline(std::cin, line) || line.empty())
+      break;
+
+    bool ok;
+    double lambda = QString::fromStdString(line).trimmed().toDouble(&ok);
+    if (!ok) {
+      std::cout << "Invalid lambda\n";
+      continue;
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+    double flow;
+    VoxelList vlist = cut.cut(lambda, &flow);
+    QString path = QString("%1_l%2_m%3.ply").arg(basePath).arg(lambda).arg(mju);
+    recon::save_points_ply(path, model, vlist);
+    printf("lambda = %g: flow = %lf, %d surface voxels, %.3f s => %s\n",
+           lambda, flow, vlist.size(), timer.elapsed() / 1000.0, qPrintable(path));
+  }
+}
+
+static bool save_sweep_csv(const QString& path, const std::vector<SweepPoint>& points)
+{
+  QFile file(path);
+  if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Text)) {
+    qDebug() << "Cannot open output file: " << path;
+    return false;
+  }
+
+  QTextStream stream(&file);
+  stream.setRealNumberPrecision(10);
+  stream << "lambda,mju,flow,surface_voxels,seconds,ply\n";
+  for (const SweepPoint& p : points) {
+    stream << p.lambda << "," << p.mju << "," << p.flow << ","
+           << p.surface << "," << p.seconds << "," << p.path << "\n";
+  }
+  return true;
+}
 
 int main(int argc, char* argv[])
 {
@@ -30,6 +263,32 @@ int main(int argc, char* argv[])
   QCommandLineOption optMju(QStringList() << "m" << "mju", "Mju", "mju");
   optMju.setDefaultValue("2.0");
   parser.addOption(optMju);
+  QCommandLineOption optThreads(QStringList() << "j" << "threads", "Max-flow Threads (1 = serial solver, 0 = all cores)", "threads");
+  optThreads.setDefaultValue("1");
+  parser.addOption(optThreads);
+  QCommandLineOption optBlockSize("block-size", "Block Size of the Parallel Solver", "size");
+  optBlockSize.setDefaultValue("32");
+  parser.addOption(optBlockSize);
+  QCommandLineOption optCapacity(QStringList() << "c" << "capacity", "Capacity Type of the Solver (double, float, int)", "type");
+  optCapacity.setDefaultValue("double");
+  parser.addOption(optCapacity);
+  QCommandLineOption optCompare("compare", "Also solve in double precision and report the differences");
+  parser.addOption(optCompare);
+
+  QCommandLineOption optLambdas("lambdas", "Sweep: comma separated lambdas", "list");
+  parser.addOption(optLambdas);
+  QCommandLineOption optMjus("mjus", "Sweep: comma separated mjus", "list");
+  parser.addOption(optMjus);
+  QCommandLineOption optCsv("csv", "Sweep: CSV of flow and surface size per pair", "path");
+  parser.addOption(optCsv);
+  QCommandLineOption optJobs("jobs", "Sweep: cuts run at once", "jobs");
+  optJobs.setDefaultValue("1");
+  parser.addOption(optJobs);
+  QCommandLineOption optMemory("memory", "Sweep: memory budget in MB (0 = unlimited)", "mb");
+  optMemory.setDefaultValue("0");
+  parser.addOption(optMemory);
+  QCommandLineOption optInteractive(QStringList() << "i" << "interactive", "Read lambdas from the standard input and cut each one");
+  parser.addOption(optInteractive);
 
   parser.process(app);
 
@@ -44,23 +303,89 @@ int main(int argc, char* argv[])
 
   using recon::Point3;
   using recon::AABox;
-  using recon::VoxelGraph;
-  using recon::VoxelModel;
-  using recon::VoxelList;
 
-  VoxelGraph graph;
-  if (!recon::load_graph(graph, graphPath)) {
-    return 1;
-  }
+  using recon::MappedVoxelGraph;
+  using recon::SparseVoxelGraph;
 
   double lambda = parser.value(optLambda).toDouble();
   double mju = parser.value(optMju).toDouble();
+  GraphCutOptions options(parser.value(optThreads).toInt(),
+                          parser.value(optBlockSize).toInt());
+  if (options.block_size < 1) {
+    std::cout << "Invalid block size\n";
+    return 1;
+  }
+  {
+    QString cap = parser.value(optCapacity);
+    if (cap == "float") {
+      options.capacity = recon::CapacityType::Float;
+    } else if (cap == "int") {
+      options.capacity = recon::CapacityType::Int;
+    } else if (cap != "double") {
+      std::cout << "Unknown capacity type: " << cap.toStdString() << "\n";
+      return 1;
+    }
+  }
+  bool compare = parser.isSet(optCompare);
+  bool tuning = parser.isSet(optInteractive);
 
-  VoxelList vlist = graph_cut(graph, lambda, mju);
-  VoxelModel model(graph.level, AABox(Point3::load(graph.voxel_minpos),
-                                      Point3::load(graph.voxel_maxpos)));
-  recon::save_points_ply(outputPath, model, vlist);
-  //recon::save_voxels(model, vlist, outputPath);
+  // Sweep over the grid of lambdas x mjus
+  bool sweeping = parser.isSet(optLambdas) || parser.isSet(optMjus);
+  std::vector<SweepPoint> points;
+  QString basePath = outputPath;
+  if (basePath.endsWith(".ply"))
+    basePath.chop(4);
+  if (sweeping) {
+    std::vector<double> lambdas(1, lambda), mjus(1, mju);
+    if ((parser.isSet(optLambdas) && !parse_values(parser.value(optLambdas), lambdas)) ||
+        (parser.isSet(optMjus) && !parse_values(parser.value(optMjus), mjus))) {
+      std::cout << "Invalid list of lambdas or mjus\n";
+      return 1;
+    }
+    for (double l : lambdas) {
+      for (double m : mjus) {
+        SweepPoint p;
+        p.lambda = l, p.mju = m;
+        p.path = QString("%1_l%2_m%3.ply").arg(basePath).arg(l).arg(m);
+        p.flow = 0.0, p.surface = 0, p.seconds = 0.0;
+        points.push_back(p);
+      }
+    }
+  }
+  int num_jobs = parser.value(optJobs).toInt();
+  uint64_t memory_budget = (uint64_t)parser.value(optMemory).toLongLong() << 20;
+
+  // Dense binary graphs are mapped in place,
+  // sparse and text graphs are loaded into bricks
+  MappedVoxelGraph mapped;
+  SparseVoxelGraph graph;
+  if (mapped.map(graphPath)) {
+    VoxelModel model(mapped.level, AABox(Point3::load(mapped.voxel_minpos),
+                                         Point3::load(mapped.voxel_maxpos)));
+    if (tuning)
+      interactive(mapped, model, mju, options, basePath);
+    else if (sweeping)
+      sweep(mapped, model, points, options, num_jobs, memory_budget);
+    else
+      recon::save_points_ply(outputPath, model, optimize(mapped, lambda, mju, options, compare));
+  } else if (recon::load_graph(graph, graphPath)) {
+    VoxelModel model(graph.level, AABox(Point3::load(graph.voxel_minpos),
+                                        Point3::load(graph.voxel_maxpos)));
+    if (tuning)
+      interactive(graph, model, mju, options, basePath);
+    else if (sweeping)
+      sweep(graph, model, points, options, num_jobs, memory_budget);
+    else
+      recon::save_points_ply(outputPath, model, optimize(graph, lambda, mju, options, compare));
+  } else {
+    return 1;
+  }
+
+  if (sweeping && !tuning) {
+    QString csvPath = (parser.isSet(optCsv) ? parser.value(optCsv) : basePath + ".csv");
+    if (!save_sweep_csv(csvPath, points))
+      return 1;
+  }
 
   return 0;
 }
@@ -0,0 +1,130 @@
+#include <recon/CameraLoader.h>
+#include <recon/Pyramid.h>
+#include "../src/PhotoConsistency.h"
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDir>
+#include <QString>
+#include <QtDebug>
+#include <stdlib.h>
+#include <algorithm>
+#include <iostream>
+
+int main(int argc, char* argv[])
+{
+  QCoreApplication app(argc, argv);
+  QCoreApplication::setApplicationName("reconstruct");
+  QCoreApplication::setApplicationVersion("1.0");
+
+  QCommandLineParser parser;
+  parser.setApplicationDescription("Coarse-to-fine reconstruction");
+  parser.addHelpOption();
+  parser.addVersionOption();
+  parser.addPositionalArgument("bundle", "Input bundle file");
+  parser.addPositionalArgument("output", "Output PLY file");
+
+  QCommandLineOption optLevel(QStringList() << "l" << "level", "Level", "level");
+  optLevel.setDefaultValue("8");
+  parser.addOption(optLevel);
+  QCommandLineOption optLevels(QStringList() << "p" << "pyramid", "Finer Levels after the First Cut", "levels");
+  optLevels.setDefaultValue("2");
+  parser.addOption(optLevels);
+  QCommandLineOption optBand(QStringList() << "b" << "band", "Half Width of the Band in Coarser Voxels", "voxels");
+  optBand.setDefaultValue("2");
+  parser.addOption(optBand);
+  QCommandLineOption optTileSize("tile-size", "Largest Grid Side Handed to the Solver", "size");
+  optTileSize.setDefaultValue("256");
+  parser.addOption(optTileSize);
+
+  QCommandLineOption optLambda("lambda", "Lambda", "lambda");
+  optLambda.setDefaultValue("0.5");
+  parser.addOption(optLambda);
+  QCommandLineOption optMju(QStringList() << "m" << "mju", "Mju", "mju");
+  optMju.setDefaultValue("2.0");
+  parser.addOption(optMju);
+
+  QCommandLineOption optThreshold(QStringList() << "t" << "threshold", "Threshold of Voting", "threshold");
+  parser.addOption(optThreshold);
+  QCommandLineOption optDisableAutoThreshold("no-auto-threshold", "Disable Automatic Thresholding");
+  parser.addOption(optDisableAutoThreshold);
+  QCommandLineOption optRectified("rectified", "Correlate on strips rectified along the epipolar lines");
+  parser.addOption(optRectified);
+  QCommandLineOption optAvx2("avx2", "Correlate with AVX2 and FMA if the CPU has them (rounds differently)");
+  parser.addOption(optAvx2);
+  QCommandLineOption optSharedFaces("shared-faces", "Vote the faces of a voxel from one evaluation per view");
+  parser.addOption(optSharedFaces);
+  QCommandLineOption optVisibility("visibility", "Skip the views hidden from a point by the visual hull or coarser surface");
+  parser.addOption(optVisibility);
+  QCommandLineOption optDepthMaps("depth-maps", "Weight the edges from plane-sweep depth maps of every view");
+  parser.addOption(optDepthMaps);
+  QCommandLineOption optImageBudget("image-budget", "Megabytes of Images Kept in Memory (0 = all)", "MB");
+  optImageBudget.setDefaultValue("0");
+  parser.addOption(optImageBudget);
+  QCommandLineOption optMaxImageWidth("max-image-width", "Images Are Halved Until No Wider Than This (0 = never)", "width");
+  optMaxImageWidth.setDefaultValue("960");
+  parser.addOption(optMaxImageWidth);
+  QCommandLineOption optThreads(QStringList() << "j" << "threads", "Voting Threads (0 = all cores)", "threads");
+  optThreads.setDefaultValue("0");
+  parser.addOption(optThreads);
+  QCommandLineOption optCutThreads("cut-threads", "Max-flow Threads (1 = serial solver, 0 = all cores)", "threads");
+  optCutThreads.setDefaultValue("1");
+  parser.addOption(optCutThreads);
+
+  parser.process(app);
+
+  const QStringList args = parser.positionalArguments();
+  if (args.count() < 2) {
+    std::cout << "Bundle path and output path?\n";
+    return 0;
+  }
+
+  const QString bundlePath = args.at(0);
+  const QString outputPath = args.at(1);
+
+  recon::CameraLoader loader;
+  if (!loader.load_from_nvm(bundlePath)) {
+    qDebug() << "Cannot load cameras from " << bundlePath;
+    return 1;
+  }
+
+  QList<recon::Camera> cameras = loader.cameras();
+  for (recon::Camera cam : cameras) {
+    QString path =  cam.imagePath();
+    QString rootname = path.section(QDir::separator(), 0, -3, QString::SectionIncludeLeadingSep);
+    QString filename = path.section(QDir::separator(), -1);
+    QString mpath = rootname + QString(QDir::separator()) + "masks" + QString(QDir::separator()) + filename;
+    cam.setMaskPath(mpath);
+  }
+
+  using recon::PhotoConsistency;
+  PhotoConsistency::EnableAutoThresholding = !parser.isSet(optDisableAutoThreshold);
+  if (parser.isSet(optThreshold))
+    PhotoConsistency::VotingThreshold = parser.value(optThreshold).toDouble();
+  recon::VoxelScore1::RectifiedEpipolar = parser.isSet(optRectified);
+  if (parser.isSet(optAvx2))
+    recon::set_zncc_kernel(recon::ZnccKernel::AVX2);
+  PhotoConsistency::SharedFaceVotes = parser.isSet(optSharedFaces);
+  PhotoConsistency::UseVisibility = parser.isSet(optVisibility);
+  PhotoConsistency::DepthMapVotes = parser.isSet(optDepthMaps);
+  PhotoConsistency::ImageBudget = parser.value(optImageBudget).toInt();
+  PhotoConsistency::MaxImageWidth = parser.value(optMaxImageWidth).toInt();
+
+  int level = parser.value(optLevel).toInt();
+  recon::PyramidOptions options(parser.value(optLevels).toInt(),
+                                parser.value(optBand).toInt(),
+                                parser.value(optTileSize).toInt(),
+                                parser.value(optThreads).toInt(),
+                                recon::GraphCutOptions(parser.value(optCutThreads).toInt()));
+  if (options.band < 1 || options.tile_size < 8) {
+    std::cout << "Invalid band or tile size\n";
+    return 1;
+  }
+  printf("level = %d, first cut at level %d\n", level, std::max(1, level - options.levels));
+
+  recon::VoxelModel model(level, loader.model_boundingbox());
+  double lambda = parser.value(optLambda).toDouble();
+  double mju = parser.value(optMju).toDouble();
+  recon::VoxelList surface = recon::reconstruct_pyramid(model, cameras, lambda, mju, options);
+  recon::save_points_ply(outputPath, model, surface);
+  return 0;
+}
@@ -0,0 +1,95 @@
+#include "../src/Zncc.h"
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QString>
+#include <stdlib.h>
+#include <math.h>
+#include <algorithm>
+#include <iostream>
+#include <vector>
+
+using recon::SampleWindow;
+using recon::ZnccKernel;
+using recon::ZnccReference;
+
+// Windows with a random texture of random contrast
+static void random_windows(std::vector<SampleWindow>& windows, int count)
+{
+  windows.resize(count);
+  for (SampleWindow& w : windows) {
+    float base = (float)rand() / RAND_MAX;
+    float contrast = 0.05f + 0.5f * (float)rand() / RAND_MAX;
+    for (int i = 0; i < 121; ++i)
+      w.gray[i] = base + contrast * ((float)rand() / RAND_MAX - 0.5f);
+    w.valid = true;
+  }
+}
+
+int main(int argc, char* argv[])
+{
+  QCoreApplication app(argc, argv);
+  QCoreApplication::setApplicationName("zncc-bench");
+  QCoreApplication::setApplicationVersion("1.0");
+
+  QCommandLineParser parser;
+  parser.setApplicationDescription("Measure the ZNCC kernels");
+  parser.addHelpOption();
+  parser.addVersionOption();
+
+  QCommandLineOption optWindows(QStringList() << "n" << "windows", "Windows per reference", "count");
+  optWindows.setDefaultValue("4096");
+  parser.addOption(optWindows);
+  QCommandLineOption optRounds(QStringList() << "r" << "rounds", "References", "count");
+  optRounds.setDefaultValue("256");
+  parser.addOption(optRounds);
+  parser.process(app);
+
+  const int num_windows = std::max(1, parser.value(optWindows).toInt());
+  const int num_rounds = std::max(1, parser.value(optRounds).toInt());
+
+  std::vector<SampleWindow> refs, windows;
+  random_windows(refs, num_rounds);
+  random_windows(windows, num_windows);
+
+  // Every reference against every window, as in one epipolar sweep
+  std::vector<float> expected((size_t)num_rounds * num_windows);
+  QElapsedTimer timer;
+  timer.start();
+  for (int r = 0; r < num_rounds; ++r) {
+    for (int k = 0; k < num_windows; ++k)
+      expected[(size_t)r * num_windows + k] = recon::NormalizedCrossCorrelation(refs[r], windows[k]);
+  }
+  const double calls = (double)num_rounds * num_windows;
+  const double base_ns = timer.nsecsElapsed() / calls;
+  printf("%-28s %8.1f ns/call\n", "NormalizedCrossCorrelation", base_ns);
+
+  const ZnccKernel kernels[] = { ZnccKernel::Scalar, ZnccKernel::SSE, ZnccKernel::AVX2 };
+  const char* names[] = { "cached reference, scalar", "cached reference, SSE", "cached reference, AVX2" };
+  const ZnccKernel selected = recon::zncc_kernel();
+  for (int i = 0; i < 3; ++i) {
+    if (!recon::zncc_kernel_supported(kernels[i])) {
+      printf("%-28s not supported by this CPU\n", names[i]);
+      continue;
+    }
+    recon::set_zncc_kernel(kernels[i]);
+
+    float max_diff = 0.0f;
+    double sum = 0.0;
+    timer.restart();
+    for (int r = 0; r < num_rounds; ++r) {
+      ZnccReference ref(refs[r]);
+      for (int k = 0; k < num_windows; ++k) {
+        float v = recon::zncc(ref, windows[k]);
+        sum += v;
+        max_diff = std::max(max_diff, fabsf(v - expected[(size_t)r * num_windows + k]));
+      }
+    }
+    double ns = timer.nsecsElapsed() / calls;
+    printf("%-28s %8.1f ns/call  speedup %5.2fx  max difference %.2g%s\n",
+           names[i], ns, base_ns / ns, max_diff, (kernels[i] == selected ? "  (default)" : ""));
+    (void)sum;
+  }
+  recon::set_zncc_kernel(selected);
+  return 0;
+}